@@ -17,6 +17,8 @@
 #define VM_FLAGS_NO_RAMDISK		(1 << 3)
 #define VM_FLAGS_NO_BOOTIMAGE		(1 << 4)
 #define VM_FLAGS_HAS_EARLYPRINTK	(1 << 5)
+#define VM_FLAGS_DEMAND_MEM		(1 << 6)
+#define VM_FLAGS_GANG_SCHED		(1 << 7)
 
 #define VM_FLAGS_SETUP_OF		(1 << 8)
 #define VM_FLAGS_SETUP_ACPI		(1 << 9)
@@ -36,6 +38,9 @@ struct vmtag {
 	unsigned long flags;
 	uint32_t vcpu_affinity[8];
 	uint64_t mmap_base;
+	uint64_t prefault_size;
+	uint32_t sched_weight;
+	uint32_t sched_cap;
 };
 
 #define IOCTL_CREATE_VM			0xf000
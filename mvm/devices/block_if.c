@@ -42,10 +42,23 @@
 #include <signal.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <mvm.h>
 #include <block_if.h>
 #include <ahci.h>
 
-#define MAXCOMLEN	19
+/*
+ * io_uring is used through the raw syscalls, so the only build
+ * requirement is a set of kernel headers that know about it.
+ */
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && \
+	defined(__NR_io_uring_register)
+#include <linux/io_uring.h>
+#ifdef IOSQE_IO_LINK
+#define BLOCKIF_HAVE_URING
+#endif
+#endif
 
 /*
  * Notes:
@@ -64,6 +77,15 @@
 #define BLOCKIF_NUMTHR	8
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
 
+/*
+ * Each request needs at most two sqes (write + linked fsync), keep
+ * some room for the wakeup nop used by blockif_close.
+ */
+#define BLOCKIF_URING_ENTRIES	256
+#define BLOCKIF_URING_POLL_US	50
+#define BLOCKIF_URING_BUFSZ	(1UL << 30)
+#define BLOCKIF_URING_FSYNC	1UL
+
 /*
  * Debug printf
  */
@@ -78,6 +100,11 @@ enum blockop {
 	BOP_DELETE
 };
 
+enum blockaio {
+	BAIO_THREADS,
+	BAIO_URING
+};
+
 enum blockstat {
 	BST_FREE,
 	BST_BLOCK,
@@ -93,7 +120,40 @@ struct blockif_elem {
 	enum blockstat	     status;
 	pthread_t            tid;
 	off_t		     block;
+	int		     nr_sqes;
+	int		     err;
+};
+
+#ifdef BLOCKIF_HAVE_URING
+struct blockif_uring {
+	int			fd;
+	unsigned		sq_entries;
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_mask;
+	unsigned		*sq_array;
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		*cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void			*sq_ring;
+	void			*cq_ring;
+	size_t			sq_ring_sz;
+	size_t			cq_ring_sz;
+	size_t			sqes_sz;
+	unsigned		sqe_tail;
+	unsigned		to_submit;
+
+	/* guest memory registered as fixed buffers */
+	void			*mem_base;
+	size_t			mem_size;
+	int			nr_bufs;
+
+	unsigned		inflight;
+	pthread_t		cq_tid;
 };
+#endif
 
 struct blockif_ctxt {
 	int			magic;
@@ -110,6 +170,10 @@ struct blockif_ctxt {
 	int			psectsz;
 	int			psectoff;
 	int			closing;
+	int			aio;
+	int			plugged;
+	struct blockif_ctxt	*parent;
+	struct blockif_uring	*ring;
 	pthread_t		btid[BLOCKIF_NUMTHR];
 	pthread_mutex_t		mtx;
 	pthread_cond_t		cond;
@@ -233,11 +297,36 @@ blockif_complete(struct blockif_ctxt *bc, struct blockif_elem *be)
 	TAILQ_INSERT_TAIL(&bc->freeq, be, link);
 }
 
+static int
+blockif_discard(struct blockif_ctxt *bc, struct blockif_req *br)
+{
+	off_t arg[2];
+	int err;
+
+	/* only used by AHCI */
+	err = 0;
+	if (!bc->candelete)
+		err = EOPNOTSUPP;
+	else if (bc->rdonly)
+		err = EROFS;
+	else if (bc->isblk) {
+		arg[0] = br->offset;
+		arg[1] = br->resid;
+		if (ioctl(bc->fd, BLKDISCARD, arg))
+			err = errno;
+		else
+			br->resid = 0;
+	}
+	else
+		err = EOPNOTSUPP;
+
+	return err;
+}
+
 static void
 blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be, uint8_t *buf)
 {
 	struct blockif_req *br;
-	off_t arg[2];
 	ssize_t clen, len, off, boff, voff;
 	int i, err;
 
@@ -333,21 +422,7 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be, uint8_t *buf)
 			err = errno;
 		break;
 	case BOP_DELETE:
-		/* only used by AHCI */
-		if (!bc->candelete)
-			err = EOPNOTSUPP;
-		else if (bc->rdonly)
-			err = EROFS;
-		else if (bc->isblk) {
-			arg[0] = br->offset;
-			arg[1] = br->resid;
-			if (ioctl(bc->fd, BLKDISCARD, arg))
-				err = errno;
-			else
-				br->resid = 0;
-		}
-		else
-			err = EOPNOTSUPP;
+		err = blockif_discard(bc, br);
 		break;
 	default:
 		err = EINVAL;
@@ -395,6 +470,516 @@ blockif_thr(void *arg)
 	return NULL;
 }
 
+#ifdef BLOCKIF_HAVE_URING
+/*
+ * io_uring engine. Requests are turned into sqes under bc->mtx and
+ * handed to the kernel with one io_uring_enter() per batch; a single
+ * completion thread reaps the cq ring, spinning for a short while
+ * while i/o is in flight before it sleeps in the kernel.
+ */
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+		   unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void
+blockif_uring_release(struct blockif_uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_sz);
+	if (ring->cq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_sz);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_sz);
+	close(ring->fd);
+	free(ring);
+}
+
+static void *
+blockif_uring_mmap(int fd, size_t size, off_t off)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, fd, off);
+
+	return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+
+static int
+blockif_uring_init(struct blockif_ctxt *bc)
+{
+	struct io_uring_params p;
+	struct blockif_uring *ring;
+	int err;
+
+	ring = calloc(1, sizeof(struct blockif_uring));
+	if (!ring)
+		return -ENOMEM;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = sys_io_uring_setup(BLOCKIF_URING_ENTRIES, &p);
+	if (ring->fd < 0) {
+		err = -errno;
+		free(ring);
+		return err;
+	}
+
+	ring->sq_entries = p.sq_entries;
+	ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_sz = p.cq_off.cqes +
+			p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = blockif_uring_mmap(ring->fd, ring->sq_ring_sz,
+			IORING_OFF_SQ_RING);
+	ring->cq_ring = blockif_uring_mmap(ring->fd, ring->cq_ring_sz,
+			IORING_OFF_CQ_RING);
+	ring->sqes = blockif_uring_mmap(ring->fd, ring->sqes_sz,
+			IORING_OFF_SQES);
+	if (!ring->sq_ring || !ring->cq_ring || !ring->sqes) {
+		err = -ENOMEM;
+		blockif_uring_release(ring);
+		return err;
+	}
+
+	ring->sq_head = ring->sq_ring + p.sq_off.head;
+	ring->sq_tail = ring->sq_ring + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ring + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ring + p.sq_off.array;
+	ring->cq_head = ring->cq_ring + p.cq_off.head;
+	ring->cq_tail = ring->cq_ring + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ring + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ring + p.cq_off.cqes;
+	ring->sqe_tail = *ring->sq_tail;
+
+	bc->ring = ring;
+
+	return 0;
+}
+
+static unsigned
+blockif_uring_space(struct blockif_uring *ring)
+{
+	unsigned head;
+
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	return ring->sq_entries - (ring->sqe_tail - head);
+}
+
+/*
+ * Called with bc->mtx held, the caller has already checked
+ * that there is a free slot in the sq ring.
+ */
+static struct io_uring_sqe *
+blockif_uring_get_sqe(struct blockif_uring *ring, unsigned long data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned index;
+
+	index = ring->sqe_tail & *ring->sq_mask;
+	sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->user_data = data;
+
+	ring->sq_array[index] = index;
+	ring->sqe_tail++;
+	ring->to_submit++;
+	__atomic_add_fetch(&ring->inflight, 1, __ATOMIC_RELAXED);
+
+	return sqe;
+}
+
+static int
+blockif_uring_flush(struct blockif_uring *ring)
+{
+	int ret;
+
+	if (!ring->to_submit)
+		return 0;
+
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+	do {
+		ret = sys_io_uring_enter(ring->fd, ring->to_submit, 0, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	/*
+	 * EAGAIN and EBUSY mean the kernel is short of resources or
+	 * the cq ring is full, the sqes stay in the ring and will be
+	 * submitted again once some completions have been reaped
+	 */
+	if (ret < 0)
+		return -errno;
+
+	ring->to_submit -= ret;
+
+	return 0;
+}
+
+/*
+ * Return the index of the registered buffer which covers the
+ * request, or -1 if the request can not use a fixed buffer.
+ */
+static int
+blockif_uring_fixed_index(struct blockif_uring *ring, struct blockif_req *br)
+{
+	unsigned long base, start, end;
+	int index;
+
+	if (!ring->nr_bufs || br->iovcnt != 1)
+		return -1;
+
+	base = (unsigned long)ring->mem_base;
+	start = (unsigned long)br->iov[0].iov_base;
+	end = start + br->iov[0].iov_len;
+	if ((start < base) || (end > base + ring->mem_size))
+		return -1;
+
+	index = (start - base) / BLOCKIF_URING_BUFSZ;
+	if (end > base + (index + 1) * BLOCKIF_URING_BUFSZ)
+		return -1;
+
+	return index;
+}
+
+static void
+blockif_uring_prep(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_uring *ring = bc->ring;
+	struct blockif_req *br = be->req;
+	struct io_uring_sqe *sqe;
+	int opcode, index, sync = 0;
+
+	be->err = 0;
+	be->nr_sqes = 1;
+
+	switch (be->op) {
+	case BOP_READ:
+		opcode = IORING_OP_READV;
+		break;
+	case BOP_WRITE:
+		opcode = IORING_OP_WRITEV;
+		sync = !bc->wce;
+		if (bc->rdonly)
+			be->err = EROFS;
+		break;
+	case BOP_FLUSH:
+		opcode = IORING_OP_FSYNC;
+		break;
+	case BOP_DELETE:
+		/* not supported by io_uring, do it inline */
+		be->err = blockif_discard(bc, br);
+		opcode = IORING_OP_NOP;
+		break;
+	default:
+		be->err = EINVAL;
+		opcode = IORING_OP_NOP;
+		break;
+	}
+
+	/*
+	 * requests which fail early still go through the ring as
+	 * a nop, so the callback is always called from the
+	 * completion thread and never with bc->mtx held
+	 */
+	if (be->err)
+		opcode = IORING_OP_NOP;
+
+	sqe = blockif_uring_get_sqe(ring, (unsigned long)be);
+	sqe->opcode = opcode;
+	sqe->fd = bc->fd;
+
+	if ((opcode == IORING_OP_READV) || (opcode == IORING_OP_WRITEV)) {
+		sqe->off = br->offset + bc->sub_file_start_lba;
+		index = blockif_uring_fixed_index(ring, br);
+		if (index >= 0) {
+			sqe->opcode = (opcode == IORING_OP_READV) ?
+				IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+			sqe->addr = (unsigned long)br->iov[0].iov_base;
+			sqe->len = br->iov[0].iov_len;
+			sqe->buf_index = index;
+		} else {
+			sqe->addr = (unsigned long)br->iov;
+			sqe->len = br->iovcnt;
+		}
+	}
+
+	/*
+	 * write through mode, the fsync is linked to the write so
+	 * it only starts after the data has been written
+	 */
+	if (sync && (opcode == IORING_OP_WRITEV)) {
+		sqe->flags |= IOSQE_IO_LINK;
+		sqe = blockif_uring_get_sqe(ring,
+				(unsigned long)be | BLOCKIF_URING_FSYNC);
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fd = bc->fd;
+		be->nr_sqes++;
+	}
+}
+
+/*
+ * Move all the unblocked pending requests to the sq ring, called
+ * with bc->mtx held.
+ */
+static void
+blockif_uring_submit(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ring = bc->ring;
+	struct blockif_elem *be;
+	int err;
+
+	for (;;) {
+		if (blockif_uring_space(ring) < 2) {
+			blockif_uring_flush(ring);
+			if (blockif_uring_space(ring) < 2)
+				break;
+		}
+
+		if (!blockif_dequeue(bc, 0, &be))
+			break;
+
+		blockif_uring_prep(bc, be);
+	}
+
+	if (bc->plugged)
+		return;
+
+	err = blockif_uring_flush(ring);
+	if (err && (err != -EAGAIN) && (err != -EBUSY))
+		WPRINTF(("blockif: io_uring submit failed %d\n", err));
+}
+
+static unsigned
+blockif_uring_wait(struct blockif_uring *ring, unsigned head)
+{
+	struct timespec start, now;
+	unsigned tail;
+	long us;
+
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	if (tail != head)
+		return tail;
+
+	/*
+	 * spin a little while there is i/o in flight, fast devices
+	 * complete within the poll window and the thread avoids a
+	 * sleep and wakeup for every batch
+	 */
+	if (__atomic_load_n(&ring->inflight, __ATOMIC_RELAXED)) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		do {
+			tail = __atomic_load_n(ring->cq_tail,
+					__ATOMIC_ACQUIRE);
+			if (tail != head)
+				return tail;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			us = (now.tv_sec - start.tv_sec) * 1000000 +
+				(now.tv_nsec - start.tv_nsec) / 1000;
+		} while (us < BLOCKIF_URING_POLL_US);
+	}
+
+	sys_io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+
+	return __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+}
+
+static void *
+blockif_uring_thr(void *arg)
+{
+	struct blockif_ctxt *bc = arg;
+	struct blockif_uring *ring = bc->ring;
+	struct blockif_elem *done[BLOCKIF_MAXREQ];
+	struct blockif_elem *be;
+	struct blockif_req *br;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	unsigned long data;
+	int i, nr, res, exit;
+
+	for (;;) {
+		head = *ring->cq_head;
+		tail = blockif_uring_wait(ring, head);
+
+		nr = 0;
+		while (head != tail) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			data = cqe->user_data;
+			res = cqe->res;
+			head++;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+			__atomic_sub_fetch(&ring->inflight, 1, __ATOMIC_RELAXED);
+
+			/* wakeup from blockif_close */
+			be = (struct blockif_elem *)(data & ~BLOCKIF_URING_FSYNC);
+			if (!be)
+				continue;
+
+			br = be->req;
+			if (res < 0) {
+				if (!be->err)
+					be->err = -res;
+			} else if (!(data & BLOCKIF_URING_FSYNC) &&
+					((be->op == BOP_READ) ||
+					 (be->op == BOP_WRITE)))
+				br->resid -= res;
+
+			if (--be->nr_sqes == 0) {
+				be->status = BST_DONE;
+				done[nr++] = be;
+			}
+		}
+
+		for (i = 0; i < nr; i++) {
+			br = done[i]->req;
+			(*br->callback)(br, done[i]->err);
+		}
+
+		pthread_mutex_lock(&bc->mtx);
+		for (i = 0; i < nr; i++)
+			blockif_complete(bc, done[i]);
+
+		/* requests which were blocked by the completed ones */
+		blockif_uring_submit(bc);
+
+		exit = bc->closing && TAILQ_EMPTY(&bc->busyq) &&
+			TAILQ_EMPTY(&bc->pendq);
+		pthread_mutex_unlock(&bc->mtx);
+
+		if (exit)
+			break;
+	}
+
+	pthread_exit(NULL);
+	return NULL;
+}
+
+static int
+blockif_uring_register(struct blockif_ctxt *bc, void *base, size_t size)
+{
+	struct blockif_uring *ring = bc->ring;
+	struct iovec *iov;
+	int i, nr, ret;
+
+	nr = (size + BLOCKIF_URING_BUFSZ - 1) / BLOCKIF_URING_BUFSZ;
+	iov = calloc(nr, sizeof(struct iovec));
+	if (!iov)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		iov[i].iov_base = base + i * BLOCKIF_URING_BUFSZ;
+		iov[i].iov_len = MIN(size - i * BLOCKIF_URING_BUFSZ,
+				BLOCKIF_URING_BUFSZ);
+	}
+
+	/*
+	 * the buffers are pinned by the kernel, this may fail due
+	 * to RLIMIT_MEMLOCK, the engine still works without them
+	 */
+	ret = sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS,
+			iov, nr);
+	free(iov);
+	if (ret < 0) {
+		ret = -errno;
+		WPRINTF(("blockif: register guest memory failed %d\n", ret));
+		return ret;
+	}
+
+	ring->mem_base = base;
+	ring->mem_size = size;
+	ring->nr_bufs = nr;
+
+	return 0;
+}
+static int
+blockif_uring_start(struct blockif_ctxt *bc, const char *ident)
+{
+	char tname[MAXCOMLEN + 1];
+	int err;
+
+	err = blockif_uring_init(bc);
+	if (err)
+		return err;
+
+	/*
+	 * register the guest memory as fixed buffers before the
+	 * completion thread starts, io_uring_register() waits for
+	 * the ring to be idle
+	 */
+	if (mvm_vm && mvm_vm->mmap)
+		blockif_uring_register(bc, mvm_vm->mmap, mvm_vm->mem_size);
+
+	err = pthread_create(&bc->ring->cq_tid, NULL, blockif_uring_thr, bc);
+	if (err) {
+		blockif_uring_release(bc->ring);
+		bc->ring = NULL;
+		return -err;
+	}
+
+	snprintf(tname, sizeof(tname), "blk-%s-uring", ident);
+	pthread_setname_np(bc->ring->cq_tid, tname);
+
+	return 0;
+}
+
+static void
+blockif_uring_stop(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ring = bc->ring;
+	struct io_uring_sqe *sqe;
+	void *jval;
+
+	/* queue a nop to wake up the completion thread */
+	pthread_mutex_lock(&bc->mtx);
+	if (blockif_uring_space(ring) < 1)
+		blockif_uring_flush(ring);
+	sqe = blockif_uring_get_sqe(ring, 0);
+	sqe->opcode = IORING_OP_NOP;
+	blockif_uring_flush(ring);
+	pthread_mutex_unlock(&bc->mtx);
+
+	pthread_join(ring->cq_tid, &jval);
+
+	blockif_uring_release(ring);
+	bc->ring = NULL;
+}
+
+#else
+static int
+blockif_uring_start(struct blockif_ctxt *bc, const char *ident)
+{
+	return -ENOSYS;
+}
+
+static void
+blockif_uring_submit(struct blockif_ctxt *bc)
+{
+}
+
+static void
+blockif_uring_stop(struct blockif_ctxt *bc)
+{
+}
+#endif
+
 static void
 blockif_sigcont_handler(int signal)
 {
@@ -476,18 +1061,50 @@ sub_file_unlock(struct blockif_ctxt *bc)
 }
 
 
+static void
+blockif_start(struct blockif_ctxt *bc, const char *ident)
+{
+	char tname[MAXCOMLEN + 1];
+	int i, err;
+
+	pthread_mutex_init(&bc->mtx, NULL);
+	pthread_cond_init(&bc->cond, NULL);
+	TAILQ_INIT(&bc->freeq);
+	TAILQ_INIT(&bc->pendq);
+	TAILQ_INIT(&bc->busyq);
+	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
+		bc->reqs[i].status = BST_FREE;
+		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
+	}
+
+	if (bc->aio == BAIO_URING) {
+		err = blockif_uring_start(bc, ident);
+		if (!err)
+			return;
+
+		fprintf(stderr, "blockif: io_uring not available (%d), "
+				"fall back to thread pool\n", err);
+	}
+
+	bc->aio = BAIO_THREADS;
+	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
+		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
+		snprintf(tname, sizeof(tname), "blk-%s-%d", ident, i);
+		pthread_setname_np(bc->btid[i], tname);
+	}
+}
+
 struct blockif_ctxt *
 blockif_open(const char *optstr, const char *ident)
 {
-	char tname[MAXCOMLEN + 1];
 	/* char name[MAXPATHLEN]; */
 	char *nopt, *xopts, *cp;
 	struct blockif_ctxt *bc;
 	struct stat sbuf;
 	/* struct diocgattr_arg arg; */
 	off_t size, psectsz, psectoff;
-	int fd, i, sectsz;
-	int writeback, ro, candelete, geom, ssopt, pssopt;
+	int fd, sectsz;
+	int writeback, ro, candelete, geom, ssopt, pssopt, aio;
 	long sz;
 	long long b;
 	int err_code = -1;
@@ -500,6 +1117,7 @@ blockif_open(const char *optstr, const char *ident)
 	ssopt = 0;
 	ro = 0;
 	sub_file_assign = 0;
+	aio = BAIO_THREADS;
 
 	/* writethru is on by default */
 	writeback = 0;
@@ -523,6 +1141,10 @@ blockif_open(const char *optstr, const char *ident)
 			writeback = 0;
 		else if (!strcmp(cp, "ro"))
 			ro = 1;
+		else if (!strcmp(cp, "aio=threads"))
+			aio = BAIO_THREADS;
+		else if (!strcmp(cp, "aio=io_uring"))
+			aio = BAIO_URING;
 		else if (sscanf(cp, "sectorsize=%d/%d", &ssopt, &pssopt) == 2)
 			;
 		else if (sscanf(cp, "sectorsize=%d", &ssopt) == 1)
@@ -669,21 +1291,8 @@ blockif_open(const char *optstr, const char *ident)
 	bc->psectsz = psectsz;
 	bc->psectoff = psectoff;
 	bc->wce = writeback;
-	pthread_mutex_init(&bc->mtx, NULL);
-	pthread_cond_init(&bc->cond, NULL);
-	TAILQ_INIT(&bc->freeq);
-	TAILQ_INIT(&bc->pendq);
-	TAILQ_INIT(&bc->busyq);
-	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
-		bc->reqs[i].status = BST_FREE;
-		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
-	}
-
-	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
-		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
-		snprintf(tname, sizeof(tname), "blk-%s-%d", ident, i);
-		pthread_setname_np(bc->btid[i], tname);
-	}
+	bc->aio = aio;
+	blockif_start(bc, ident);
 
 	return bc;
 err:
@@ -692,6 +1301,44 @@ err:
 	return NULL;
 }
 
+/*
+ * Create another context on the same backing file, with its own
+ * request slots, lock and i/o engine. Used by devices which have
+ * several request queues. The clone must be closed before the
+ * context it was created from.
+ */
+struct blockif_ctxt *
+blockif_clone(struct blockif_ctxt *bc, const char *ident)
+{
+	struct blockif_ctxt *nbc;
+
+	assert(bc->magic == BLOCKIF_SIG);
+
+	nbc = calloc(1, sizeof(struct blockif_ctxt));
+	if (nbc == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	nbc->magic = BLOCKIF_SIG;
+	nbc->parent = bc->parent ? bc->parent : bc;
+	nbc->fd = bc->fd;
+	nbc->isblk = bc->isblk;
+	nbc->isgeom = bc->isgeom;
+	nbc->candelete = bc->candelete;
+	nbc->rdonly = bc->rdonly;
+	nbc->size = bc->size;
+	nbc->sub_file_start_lba = bc->sub_file_start_lba;
+	nbc->sectsz = bc->sectsz;
+	nbc->psectsz = bc->psectsz;
+	nbc->psectoff = bc->psectoff;
+	nbc->wce = bc->wce;
+	nbc->aio = bc->aio;
+	blockif_start(nbc, ident);
+
+	return nbc;
+}
+
 static int
 blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
@@ -706,8 +1353,12 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		 * Enqueue and inform the block i/o thread
 		 * that there is work available
 		 */
-		if (blockif_enqueue(bc, breq, op))
-			pthread_cond_signal(&bc->cond);
+		if (blockif_enqueue(bc, breq, op)) {
+			if (bc->aio == BAIO_URING)
+				blockif_uring_submit(bc);
+			else
+				pthread_cond_signal(&bc->cond);
+		}
 	} else {
 		/*
 		 * Callers are not allowed to enqueue more than
@@ -722,6 +1373,31 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 	return err;
 }
 
+/*
+ * Requests issued between blockif_plug() and blockif_unplug() are
+ * queued and submitted together, the thread pool ignores this.
+ */
+void
+blockif_plug(struct blockif_ctxt *bc)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+
+	pthread_mutex_lock(&bc->mtx);
+	bc->plugged++;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+void
+blockif_unplug(struct blockif_ctxt *bc)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+
+	pthread_mutex_lock(&bc->mtx);
+	if ((--bc->plugged == 0) && (bc->aio == BAIO_URING))
+		blockif_uring_submit(bc);
+	pthread_mutex_unlock(&bc->mtx);
+}
+
 int
 blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
@@ -790,6 +1466,15 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		return -1;
 	}
 
+	/*
+	 * Requests owned by the kernel can not be interrupted, the
+	 * completion thread will call the callback later.
+	 */
+	if (bc->aio == BAIO_URING) {
+		pthread_mutex_unlock(&bc->mtx);
+		return -EBUSY;
+	}
+
 	/*
 	 * Interrupt the processing thread to force it return
 	 * prematurely via it's normal callback path.
@@ -834,7 +1519,8 @@ blockif_close(struct blockif_ctxt *bc)
 	int i;
 
 	assert(bc->magic == BLOCKIF_SIG);
-	sub_file_unlock(bc);
+	if (!bc->parent)
+		sub_file_unlock(bc);
 
 	/*
 	 * Stop the block i/o thread
@@ -842,9 +1528,14 @@ blockif_close(struct blockif_ctxt *bc)
 	pthread_mutex_lock(&bc->mtx);
 	bc->closing = 1;
 	pthread_mutex_unlock(&bc->mtx);
-	pthread_cond_broadcast(&bc->cond);
-	for (i = 0; i < BLOCKIF_NUMTHR; i++)
-		pthread_join(bc->btid[i], &jval);
+
+	if (bc->aio == BAIO_URING)
+		blockif_uring_stop(bc);
+	else {
+		pthread_cond_broadcast(&bc->cond);
+		for (i = 0; i < BLOCKIF_NUMTHR; i++)
+			pthread_join(bc->btid[i], &jval);
+	}
 
 	/* XXX Cancel queued i/o's ??? */
 
@@ -852,7 +1543,8 @@ blockif_close(struct blockif_ctxt *bc)
 	 * Release resources
 	 */
 	bc->magic = 0;
-	close(bc->fd);
+	if (!bc->parent)
+		close(bc->fd);
 	free(bc);
 
 	return 0;
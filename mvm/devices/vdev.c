@@ -167,6 +167,67 @@ int vdev_alloc_and_request_irq(struct vm *vm, int nr)
 	return __vdev_alloc_and_request_irq(vm, nr, 1);
 }
 
+/*
+ * find the last vdev in the map whose iomem base is
+ * not bigger than the address, the map is sorted by
+ * the guest iomem base address
+ */
+static int vdev_map_search(struct vm *vm, unsigned long addr)
+{
+	int left = 0, right = vm->nr_vdev_map - 1, mid;
+	int index = -1;
+
+	while (left <= right) {
+		mid = (left + right) >> 1;
+		if ((unsigned long)vm->vdev_map[mid]->guest_iomem <= addr) {
+			index = mid;
+			left = mid + 1;
+		} else {
+			right = mid - 1;
+		}
+	}
+
+	return index;
+}
+
+static int vdev_map_insert(struct vm *vm, struct vdev *vdev)
+{
+	int i, index;
+	struct vdev **map;
+
+	map = realloc(vm->vdev_map, sizeof(struct vdev *) *
+			(vm->nr_vdev_map + 1));
+	if (!map)
+		return -ENOMEM;
+
+	vm->vdev_map = map;
+	index = vdev_map_search(vm,
+			(unsigned long)vdev->guest_iomem) + 1;
+	for (i = vm->nr_vdev_map; i > index; i--)
+		map[i] = map[i - 1];
+
+	map[index] = vdev;
+	vm->nr_vdev_map++;
+
+	return 0;
+}
+
+struct vdev *vdev_find_by_address(struct vm *vm, unsigned long addr)
+{
+	int index;
+	struct vdev *vdev;
+
+	index = vdev_map_search(vm, addr);
+	if (index < 0)
+		return NULL;
+
+	vdev = vm->vdev_map[index];
+	if (addr >= (unsigned long)vdev->guest_iomem + vdev->iomem_size)
+		return NULL;
+
+	return vdev;
+}
+
 int create_vdev(struct vm *vm, char *class, char *args)
 {
 	struct vdev *vdev;
@@ -175,6 +236,11 @@ int create_vdev(struct vm *vm, char *class, char *args)
 	if (!vdev)
 		return -ENOMEM;
 
+	if (vdev->iomem_size && vdev_map_insert(vm, vdev)) {
+		release_vdev(vdev);
+		return -ENOMEM;
+	}
+
 	list_add_tail(&vm->vdev_list, &vdev->list);
 
 	return 0;
@@ -40,6 +40,7 @@
 
 #define VIRTIO_BLK_RINGSZ	64
 #define VIRTIO_BLK_IOVSZ	64
+#define VIRTIO_BLK_MAX_QUEUES	8
 
 #define VIRTIO_BLK_S_OK		0
 #define VIRTIO_BLK_S_IOERR	1
@@ -55,6 +56,7 @@
 
 /* Device can toggle its cache between writeback and writethrough modes */
 #define	VIRTIO_BLK_F_CONFIG_WCE	(11)
+#define	VIRTIO_BLK_F_MQ		(12)	/* Support more than one vq */
 
 /*
  * Config space "registers"
@@ -76,6 +78,8 @@ struct virtio_blk_config {
 		uint32_t opt_io_size;
 	} topology;
 	uint8_t	writeback;
+	uint8_t	unused0;
+	uint16_t num_queues;
 } __attribute__((packed));
 
 /*
@@ -95,21 +99,33 @@ struct virtio_blk_hdr {
 
 struct virtio_blk_ioreq {
 	struct blockif_req req;
-	struct virtio_blk *blk;
+	struct virtio_blk_queue *queue;
 	uint8_t *status;
 	uint16_t idx;
 };
 
+/*
+ * Per-queue struct, each virt queue has its own request slots,
+ * blockif context (and i/o threads) and completion lock
+ */
+struct virtio_blk_queue {
+	struct virtio_blk *blk;
+	struct virt_queue *vq;
+	struct blockif_ctxt *bc;
+	pthread_mutex_t mtx;
+	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
+};
+
 /*
  * Per-device struct
  */
 struct virtio_blk {
 	struct virtio_device virtio_dev;
-	pthread_mutex_t mtx;
 	struct virtio_blk_config *cfg;
 	struct blockif_ctxt *bc;
+	int nr_queues;
+	struct virtio_blk_queue *queues;
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
-	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
 	uint8_t original_wce;
 };
 
@@ -123,10 +139,7 @@ static void
 virtio_blk_done(struct blockif_req *br, int err)
 {
 	struct virtio_blk_ioreq *io = br->param;
-	struct virtio_blk *blk = io->blk;
-	struct virt_queue *vq;
-
-	vq = &blk->virtio_dev.vqs[0];
+	struct virtio_blk_queue *queue = io->queue;
 
 	/* convert errno into a virtio block error return */
 	if (err == EOPNOTSUPP || err == ENOSYS)
@@ -140,15 +153,16 @@ virtio_blk_done(struct blockif_req *br, int err)
 	 * Return the descriptor back to the host.
 	 * We wrote 1 byte (our status) to host.
 	 */
-	pthread_mutex_lock(&blk->mtx);
-	virtq_add_used_and_signal(vq, io->idx, 1);
-	pthread_mutex_unlock(&blk->mtx);
+	pthread_mutex_lock(&queue->mtx);
+	virtq_add_used_and_signal(queue->vq, io->idx, 1);
+	pthread_mutex_unlock(&queue->mtx);
 }
 
 static void
-virtio_blk_proc(struct virtio_blk *blk,
+virtio_blk_proc(struct virtio_blk_queue *queue,
 		struct virt_queue *vq, uint16_t idx, int n)
 {
+	struct virtio_blk *blk = queue->blk;
 	struct virtio_blk_hdr *vbh;
 	struct virtio_blk_ioreq *io;
 	int i;
@@ -170,7 +184,7 @@ virtio_blk_proc(struct virtio_blk *blk,
 		return;
 	}
 
-	io = &blk->ios[idx];
+	io = &queue->ios[idx];
 	if (iov[0].iov_len != sizeof(struct virtio_blk_hdr)) {
 		pr_err("wrong size of virtio_blk_hdr %ld %ld\n",
 				iov[0].iov_len, sizeof(struct virtio_blk_hdr));
@@ -210,14 +224,14 @@ virtio_blk_proc(struct virtio_blk *blk,
 
 	switch (type) {
 	case VBH_OP_READ:
-		err = blockif_read(blk->bc, &io->req);
+		err = blockif_read(queue->bc, &io->req);
 		break;
 	case VBH_OP_WRITE:
-		err = blockif_write(blk->bc, &io->req);
+		err = blockif_write(queue->bc, &io->req);
 		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
-		err = blockif_flush(blk->bc, &io->req);
+		err = blockif_flush(queue->bc, &io->req);
 		break;
 	case VBH_OP_IDENT:
 		/* Assume a single buffer */
@@ -240,15 +254,20 @@ virtio_blk_notify(struct virt_queue *vq)
 	int idx;
 	unsigned int in, out;
 	struct virtio_blk *blk;
+	struct virtio_blk_queue *queue;
 
 	blk = virtio_dev_to_blk(vq->dev);
+	queue = &blk->queues[vq->vq_index];
 	virtq_disable_notify(vq);
 
+	/* submit all the requests of this notification together */
+	blockif_plug(queue->bc);
+
 	while (virtq_has_descs(vq)) {
 		idx = virtq_get_descs(vq, vq->iovec,
 				vq->iovec_size, &in, &out);
 		if (idx < 0)
-			return;
+			break;
 
 		if (idx == vq->num) {
 			if (virtq_enable_notify(vq)) {
@@ -260,19 +279,23 @@ virtio_blk_notify(struct virt_queue *vq)
 
 		if (in) {
 			pr_err("unexpected description from guest");
-			return;
+			break;
 		}
 
-		virtio_blk_proc(blk, vq, idx, out);
+		virtio_blk_proc(queue, vq, idx, out);
 	}
+
+	blockif_unplug(queue->bc);
 }
 
 static int vblk_init_vq(struct virt_queue *vq)
 {
-	if (vq->vq_index == 0)
+	struct virtio_blk *blk = virtio_dev_to_blk(vq->dev);
+
+	if (vq->vq_index < blk->nr_queues)
 		vq->callback = virtio_blk_notify;
 	else
-		pr_err("virtio block only have one vq");
+		pr_err("virtio block only have %d vq\n", blk->nr_queues);
 
 	return 0;
 }
@@ -281,14 +304,105 @@ static struct virtio_ops vblk_ops = {
 	.vq_init = vblk_init_vq,
 };
 
+/*
+ * "queues=<n>" is handled by the device, the rest of the options
+ * are passed to blockif_open()
+ */
+static char *
+virtio_blk_parse_opts(const char *opts, int *nr_queues)
+{
+	char *nopt, *xopts, *cp, *bopts;
+	int n;
+
+	nopt = xopts = strdup(opts);
+	bopts = calloc(1, strlen(opts) + 1);
+	if (!nopt || !bopts) {
+		free(nopt);
+		free(bopts);
+		return NULL;
+	}
+
+	while ((cp = strsep(&xopts, ",")) != NULL) {
+		if ((cp != nopt) && (sscanf(cp, "queues=%d", &n) == 1)) {
+			*nr_queues = n;
+			continue;
+		}
+
+		if (cp != nopt)
+			strcat(bopts, ",");
+		strcat(bopts, cp);
+	}
+
+	free(nopt);
+	return bopts;
+}
+
+static void
+virtio_blk_close_queues(struct virtio_blk *blk)
+{
+	int i;
+
+	/* the clones must be closed before the first context */
+	for (i = blk->nr_queues - 1; i > 0; i--) {
+		if (blk->queues[i].bc)
+			blockif_close(blk->queues[i].bc);
+	}
+
+	blockif_close(blk->bc);
+}
+
+static int
+virtio_blk_init_queues(struct virtio_blk *blk, pthread_mutexattr_t *attr)
+{
+	struct virtio_blk_queue *queue;
+	struct virtio_blk_ioreq *io;
+	char bident[16];
+	int i, j, rc;
+
+	for (i = 0; i < blk->nr_queues; i++) {
+		queue = &blk->queues[i];
+		queue->blk = blk;
+		queue->vq = &blk->virtio_dev.vqs[i];
+
+		/*
+		 * every queue gets its own blockif context, so the
+		 * queues do not share request slots or i/o threads
+		 */
+		if (i == 0)
+			queue->bc = blk->bc;
+		else {
+			snprintf(bident, sizeof(bident), "%d:%d", 0, i);
+			queue->bc = blockif_clone(blk->bc, bident);
+			if (!queue->bc)
+				return -ENOMEM;
+		}
+
+		rc = pthread_mutex_init(&queue->mtx, attr);
+		if (rc)
+			pr_info("virtio_blk: pthread_mutex_init failed with "
+					"error %d!\n", rc);
+
+		for (j = 0; j < VIRTIO_BLK_RINGSZ; j++) {
+			io = &queue->ios[j];
+			io->req.callback = virtio_blk_done;
+			io->req.param = io;
+			io->queue = queue;
+			io->idx = j;
+		}
+	}
+
+	return 0;
+}
+
 static int
 virtio_blk_init(struct vdev *vdev, char *opts)
 {
 	char bident[16];
+	char *bopts;
 	struct blockif_ctxt *bctxt;
 	struct virtio_blk *blk;
 	off_t size;
-	int i, sectsz, sts, sto;
+	int sectsz, sts, sto, nr_queues;
 	pthread_mutexattr_t attr;
 	int rc;
 
@@ -297,11 +411,23 @@ virtio_blk_init(struct vdev *vdev, char *opts)
 		return -1;
 	}
 
+	/* one queue for each vcpu by default */
+	nr_queues = vdev->vm->nr_vcpus;
+	bopts = virtio_blk_parse_opts(opts, &nr_queues);
+	if (!bopts)
+		return -ENOMEM;
+
+	if (nr_queues < 1)
+		nr_queues = 1;
+	else if (nr_queues > VIRTIO_BLK_MAX_QUEUES)
+		nr_queues = VIRTIO_BLK_MAX_QUEUES;
+
 	/*
 	 * The supplied backing file has to exist
 	 */
 	snprintf(bident, sizeof(bident), "%d:%d", 0, 0);
-	bctxt = blockif_open(opts, bident);
+	bctxt = blockif_open(bopts, bident);
+	free(bopts);
 	if (bctxt == NULL) {
 		perror("Could not open backing file");
 		return -1;
@@ -317,26 +443,27 @@ virtio_blk_init(struct vdev *vdev, char *opts)
 		return -1;
 	}
 
-	/* virtio blk only has 1 virt queue */
+	blk->queues = calloc(nr_queues, sizeof(struct virtio_blk_queue));
+	if (!blk->queues) {
+		pr_warn("virtio_blk: calloc returns NULL\n");
+		free(blk);
+		blockif_close(bctxt);
+		return -1;
+	}
+
 	rc = virtio_device_init(&blk->virtio_dev, vdev,
-			VIRTIO_TYPE_BLOCK, 1, VIRTIO_BLK_RINGSZ,
+			VIRTIO_TYPE_BLOCK, nr_queues, VIRTIO_BLK_RINGSZ,
 			VIRTIO_BLK_IOVSZ);
 	if (rc) {
 		pr_err("failed to init virtio blk device\n");
+		free(blk->queues);
 		free(blk);
 		blockif_close(bctxt);
 		return rc;
 	}
 
 	blk->bc = bctxt;
-	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
-		struct virtio_blk_ioreq *io = &blk->ios[i];
-
-		io->req.callback = virtio_blk_done;
-		io->req.param = io;
-		io->blk = blk;
-		io->idx = i;
-	}
+	blk->nr_queues = nr_queues;
 
 	vdev_set_pdata(vdev, blk);
 	blk->virtio_dev.ops = &vblk_ops;
@@ -352,10 +479,16 @@ virtio_blk_init(struct vdev *vdev, char *opts)
 		pr_info("virtio_blk: mutexattr_settype failed with "
 					"error %d!\n", rc);
 
-	rc = pthread_mutex_init(&blk->mtx, &attr);
-	if (rc)
-		pr_info("virtio_blk: pthread_mutex_init failed with "
-					"error %d!\n", rc);
+	rc = virtio_blk_init_queues(blk, &attr);
+	if (rc) {
+		pr_err("failed to init virtio blk queues\n");
+		vdev_set_pdata(vdev, NULL);
+		virtio_blk_close_queues(blk);
+		virtio_device_deinit(&blk->virtio_dev);
+		free(blk->queues);
+		free(blk);
+		return rc;
+	}
 
 	sprintf(blk->ident, "Minos--%02X%02X-%02X%02X-%02X%02X",
 			0, 1, 2, 3, 4, 5);
@@ -375,6 +508,7 @@ virtio_blk_init(struct vdev *vdev, char *opts)
 	blk->cfg->topology.min_io_size = 0;
 	blk->cfg->topology.opt_io_size = 0;
 	blk->cfg->writeback = blockif_get_wce(blk->bc);
+	blk->cfg->num_queues = nr_queues;
 	blk->original_wce = blk->cfg->writeback; /* save for reset */
 
 	/* set the feature of the virtio block */
@@ -389,6 +523,9 @@ virtio_blk_init(struct vdev *vdev, char *opts)
 	virtio_set_feature(&blk->virtio_dev, VIRTIO_BLK_F_TOPOLOGY);
 	virtio_set_feature(&blk->virtio_dev,
 			VIRTIO_RING_F_INDIRECT_DESC);
+	if (nr_queues > 1)
+		virtio_set_feature(&blk->virtio_dev, VIRTIO_BLK_F_MQ);
+
 	return 0;
 }
 
@@ -407,8 +544,9 @@ virtio_blk_deinit(struct vdev *vdev)
 	if (blockif_flush_all(bctxt)) {
 		pr_warn("vrito_blk:"
 			"Failed to flush before close\n");
-		blockif_close(bctxt);
+		virtio_blk_close_queues(blk);
 		virtio_device_deinit(&blk->virtio_dev);
+		free(blk->queues);
 		free(blk);
 	}
 }
@@ -432,6 +570,7 @@ static int virtio_blk_event(struct vdev *vdev, int read,
 static int virtio_blk_reset(struct vdev *vdev)
 {
 	struct virtio_blk *blk;
+	int i;
 
 	blk = (struct virtio_blk *)vdev_get_pdata(vdev);
 	if (!blk)
@@ -439,7 +578,8 @@ static int virtio_blk_reset(struct vdev *vdev)
 
 	pr_info("virtio_blk: device reset requested !\n");
 	virtio_device_reset(&blk->virtio_dev);
-	blockif_set_wce(blk->bc, blk->original_wce);
+	for (i = 0; i < blk->nr_queues; i++)
+		blockif_set_wce(blk->queues[i].bc, blk->original_wce);
 
 	return 0;
 }
@@ -43,6 +43,7 @@ extern void * __start_vdev_ops;
 extern void *__stop_vdev_ops;
 
 int create_vdev(struct vm *vm, char *class, char *args);
+struct vdev *vdev_find_by_address(struct vm *vm, unsigned long addr);
 void *vdev_map_iomem(void *iomem, size_t size);
 void vdev_unmap_iomem(void *iomem, size_t size);
 void vdev_setup_env(struct vm *vm, void *data, int os_type);
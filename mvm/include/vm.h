@@ -65,6 +65,8 @@ struct vm {
 	int *irqs;
 
 	struct list_head vdev_list;
+	struct vdev **vdev_map;
+	int nr_vdev_map;
 };
 
 extern struct vm *mvm_vm;
@@ -201,6 +201,12 @@ int destroy_vm(struct vm *vm)
 	list_for_each_entry(vdev, &vm->vdev_list, list)
 		release_vdev(vdev);
 
+	if (vm->vdev_map) {
+		free(vm->vdev_map);
+		vm->vdev_map = NULL;
+		vm->nr_vdev_map = 0;
+	}
+
 	virtio_mmio_deinit(vm);
 	mevent_deinit();
 
@@ -288,6 +294,10 @@ void print_usage(void)
 	fprintf(stderr, "    --gicv3                    (using the gicv3 interrupt controller)\n");
 	fprintf(stderr, "    --gicv4                    (using the gicv4 interrupt controller)\n");
 	fprintf(stderr, "    --earlyprintk              (enable the earlyprintk based on virtio-console)\n");
+	fprintf(stderr, "    --demand_mem               (allocate the memory of the vm when it is accessed)\n");
+	fprintf(stderr, "    --prefault <size_in_MB>    (memory allocated at creation with --demand_mem)\n");
+	fprintf(stderr, "    --sched_weight <weight>    (cpu share of the vm on fair sched pcpus, default 256)\n");
+	fprintf(stderr, "    --sched_cap <percent>      (max percent of a pcpu each vcpu can use, 0 no cap)\n");
 	fprintf(stderr, "\n");
 	exit(EXIT_FAILURE);
 }
@@ -435,6 +445,8 @@ static void vmcs_ack(struct vmcs *vmcs)
 	if (vmcs->guest_index == vmcs->host_index)
 		return;
 
+	/* the result of the entry must be visible first */
+	wmb();
 	vmcs->guest_index++;
 	wmb();
 }
@@ -442,24 +454,18 @@ static void vmcs_ack(struct vmcs *vmcs)
 static int vcpu_handle_mmio(struct vm *vm, int trap_reason,
 		unsigned long trap_data, unsigned long *trap_result)
 {
-	int ret = -EIO;
+	int ret;
 	struct vdev *vdev;
-	unsigned long base, size;
 
-	list_for_each_entry(vdev, &vm->vdev_list, list) {
-		base = (unsigned long)vdev->guest_iomem;
-		size = vdev->iomem_size;
-		if ((trap_data >= base) && (trap_data < base + size)) {
-			pthread_mutex_lock(&vdev->lock);
-			ret = vdev->ops->event(vdev, trap_reason,
-					trap_data, trap_result);
-			pthread_mutex_unlock(&vdev->lock);
+	vdev = vdev_find_by_address(vm, trap_data);
+	if (!vdev)
+		return -ENODEV;
 
-			return ret;
-		}
-	}
+	pthread_mutex_lock(&vdev->lock);
+	ret = vdev->ops->event(vdev, trap_reason, trap_data, trap_result);
+	pthread_mutex_unlock(&vdev->lock);
 
-	return -ENODEV;
+	return ret;
 }
 
 static int vcpu_handle_common_trap(struct vm *vm, int trap_reason,
@@ -489,13 +495,13 @@ static int vcpu_handle_common_trap(struct vm *vm, int trap_reason,
 	return 0;
 }
 
-static void handle_vcpu_event(struct vmcs *vmcs)
+static void handle_vcpu_trap(struct vmcs *vmcs, struct vmcs_entry *entry)
 {
-	int ret;
-	uint32_t trap_type = vmcs->trap_type;
-	uint32_t trap_reason = vmcs->trap_reason;
-	unsigned long trap_data = vmcs->trap_data;
-	unsigned long trap_result = vmcs->trap_result;
+	int ret = -EINVAL;
+	uint32_t trap_type = entry->trap_type;
+	uint32_t trap_reason = entry->trap_reason;
+	unsigned long trap_data = entry->trap_data;
+	unsigned long trap_result = entry->trap_result;
 
 	switch (trap_type) {
 	case VMTRAP_TYPE_COMMON:
@@ -512,12 +518,25 @@ static void handle_vcpu_event(struct vmcs *vmcs)
 		break;
 	}
 
-	vmcs->trap_ret = ret;
-	vmcs->trap_result = trap_result;
+	entry->trap_ret = ret;
+	entry->trap_result = trap_result;
 
 	vmcs_ack(vmcs);
 }
 
+static void handle_vcpu_event(struct vmcs *vmcs)
+{
+	/*
+	 * the hypervisor may post several traps before
+	 * the vcpu event thread is wakeup, handle all the
+	 * traps in the vmcs ring in order
+	 */
+	while (vmcs->guest_index != vmcs->host_index) {
+		rmb();
+		handle_vcpu_trap(vmcs, vmcs_entry(vmcs, vmcs->guest_index));
+	}
+}
+
 void *vm_vcpu_thread(void *data)
 {
 	int ret;
@@ -560,9 +579,6 @@ void *vm_vcpu_thread(void *data)
 		}
 
 		eventfd_read(eventfd, &value);
-		if (value > 1)
-			pr_err("invaild vmcs state\n");
-
 		handle_vcpu_event(vmcs);
 	}
 
@@ -879,6 +895,10 @@ static struct option options[] = {
 	{"gicv2",	no_argument,	   NULL, '1'},
 	{"gicv4",	no_argument,	   NULL, '2'},
 	{"earlyprintk",	no_argument,	   NULL, '3'},
+	{"demand_mem",	no_argument,	   NULL, '4'},
+	{"prefault",	required_argument, NULL, '5'},
+	{"sched_weight", required_argument, NULL, '6'},
+	{"sched_cap",	required_argument, NULL, '7'},
 	{"help",	no_argument,	   NULL, 'h'},
 	{NULL,		0,		   NULL,  0}
 };
@@ -1070,6 +1090,20 @@ int main(int argc, char **argv)
 		case '3':
 			vmtag->flags |= VM_FLAGS_HAS_EARLYPRINTK;
 			break;
+		case '4':
+			vmtag->flags |= VM_FLAGS_DEMAND_MEM;
+			break;
+		case '5':
+			ret = parse_vm_memsize(optarg, &vmtag->prefault_size);
+			if (ret)
+				print_usage();
+			break;
+		case '6':
+			vmtag->sched_weight = strtoul(optarg, NULL, 0);
+			break;
+		case '7':
+			vmtag->sched_cap = strtoul(optarg, NULL, 0);
+			break;
 		case '2':
 			global_config->gic_type = 2;
 			break;
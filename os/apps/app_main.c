@@ -169,3 +169,60 @@ DEFINE_TASK_PERCPU("test task3", test_task3, NULL, 4096, 0);
 DEFINE_TASK_PERCPU("test task", test_task, NULL, 4096, 0);
 DEFINE_TASK_PERCPU("test task2", test_task2, NULL, 4096, 0);
 #endif
+
+#ifdef CONFIG_IPI_BENCH
+#define IPI_BENCH_LOOPS		1000
+
+static atomic_t ipi_bench_cnt;
+
+static void ipi_bench_fn(void *data)
+{
+	atomic_inc(&ipi_bench_cnt);
+}
+
+/*
+ * latency : the time of one synchronous call to a cpu
+ * throughput : the multicast calls to all other cpus
+ * without waiting, only wait for the last one
+ */
+void ipi_bench_task(void *data)
+{
+	int i, cpu, cpuid = smp_processor_id();
+	unsigned long start, delta;
+	cpumask_t mask;
+
+	while (1) {
+		cpumask_clearall(&mask);
+
+		for_each_online_cpu(cpu) {
+			if (cpu == cpuid)
+				continue;
+
+			cpumask_set_cpu(cpu, &mask);
+
+			start = NOW();
+			for (i = 0; i < IPI_BENCH_LOOPS; i++)
+				smp_function_call(cpu, ipi_bench_fn, NULL, 1);
+			delta = NOW() - start;
+
+			pr_info("ipi latency cpu-%d -> cpu-%d : %lu ns\n",
+					cpuid, cpu, delta / IPI_BENCH_LOOPS);
+		}
+
+		atomic_set(&ipi_bench_cnt, 0);
+		start = NOW();
+		for (i = 0; i < IPI_BENCH_LOOPS; i++)
+			smp_function_call_many_async(&mask, ipi_bench_fn, NULL);
+		smp_function_call_many(&mask, ipi_bench_fn, NULL, 1);
+		delta = NOW() - start;
+
+		pr_info("ipi throughput : %d calls in %lu us\n",
+				atomic_read(&ipi_bench_cnt), delta / 1000);
+		smp_call_dump_stat();
+
+		msleep(1000);
+	}
+}
+
+DEFINE_TASK_PERCPU("ipi bench", ipi_bench_task, NULL, 4096, 0);
+#endif
@@ -17,11 +17,20 @@
 #include <minos/minos.h>
 #include <minos/vmodule.h>
 #include <minos/task.h>
+#include <asm/vfp.h>
 
 #ifdef CONFIG_VIRT
 #include <virt/vm.h>
 #endif
 
+/*
+ * the fp/simd context is switched lazily, CPTR_EL2.TFP is
+ * set when a task is switched in and the context is only
+ * loaded when the task first access the fp/simd registers.
+ * vfp_owner is the task whose context is in the registers
+ * of this pcpu, if the task is switched back before other
+ * task use the fp/simd, nothing need to be restored
+ */
 struct vfp_context {
 	uint64_t regs[64] __align(16);
 #ifdef CONFIG_VIRT
@@ -29,14 +38,21 @@ struct vfp_context {
 #endif
 	uint32_t fpsr;
 	uint32_t fpcr;
+	int cpu;
 };
 
+static int vfp_vmodule_id = INVALID_MODULE_ID;
+static DEFINE_PER_CPU(struct task *, vfp_owner);
+
 static void vfp_state_init(struct task *task, void *context)
 {
-	memset(context, 0, sizeof(struct vfp_context));
+	struct vfp_context *c = (struct vfp_context *)context;
+
+	memset(c, 0, sizeof(struct vfp_context));
+	c->cpu = -1;
 }
 
-static void vfp_state_save(struct task *task, void *context)
+static void __vfp_state_save(struct task *task, void *context)
 {
 	struct vfp_context *c = (struct vfp_context *)context;
 
@@ -67,7 +83,7 @@ static void vfp_state_save(struct task *task, void *context)
                      : "=Q" (*c->regs) : "r" (c->regs));
 }
 
-static void vfp_state_restore(struct task *task, void *context)
+static void __vfp_state_restore(struct task *task, void *context)
 {
 	struct vfp_context *c = (struct vfp_context *)context;
 
@@ -98,8 +114,51 @@ static void vfp_state_restore(struct task *task, void *context)
                      : : "Q" (*c->regs), "r" (c->regs));
 }
 
+static void vfp_state_save(struct task *task, void *context)
+{
+	/*
+	 * if the task did not access the fp/simd registers
+	 * after it was switched in, the context in memory
+	 * is still up to date
+	 */
+	if (read_sysreg(CPTR_EL2) & CPTR_ELx_TFP)
+		return;
+
+	__vfp_state_save(task, context);
+}
+
+static void vfp_state_restore(struct task *task, void *context)
+{
+	/* trap the first fp/simd access of the task */
+	write_sysreg(read_sysreg(CPTR_EL2) | CPTR_ELx_TFP, CPTR_EL2);
+	isb();
+}
+
+void vfp_access_trap(struct task *task)
+{
+	struct vfp_context *c;
+	int cpu = smp_processor_id();
+
+	write_sysreg(read_sysreg(CPTR_EL2) & ~CPTR_ELx_TFP, CPTR_EL2);
+	isb();
+
+	c = get_vmodule_data_by_id(task, vfp_vmodule_id);
+	if (!c)
+		return;
+
+	/* the registers still hold the context of this task */
+	if ((get_cpu_var(vfp_owner) == task) && (c->cpu == cpu))
+		return;
+
+	__vfp_state_restore(task, c);
+	get_cpu_var(vfp_owner) = task;
+	c->cpu = cpu;
+}
+
 static int vfp_vmodule_init(struct vmodule *vmodule)
 {
+	vfp_vmodule_id = vmodule->id;
+
 	vmodule->context_size	= sizeof(struct vfp_context);
 	vmodule->state_init	= vfp_state_init;
 	vmodule->state_save	= vfp_state_save;
@@ -42,6 +42,9 @@
 
 #define MAX_SYNC_TYPE		(0x40)
 
+/* ISS of EC_WFI_WFE, 0 - trapped by wfi 1 - trapped by wfe */
+#define ESR_WFI_WFE_TI		(1 << 0)
+
 #define EC_TYPE_AARCH64		(0x1)
 #define EC_TYPE_AARCH32		(0X2)
 #define EC_TYPE_BOTH		(0x3)
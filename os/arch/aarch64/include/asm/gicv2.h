@@ -152,6 +152,7 @@ struct gicv2_context {
     uint32_t vmcr;
     uint32_t apr;
     uint32_t lr[64];
+    uint64_t lr_used;
 };
 
 struct gich_lr {
@@ -61,6 +61,7 @@
 #define GICD_CPENDSGIR			(0x0f10)
 #define GICD_SPENDSGIR			(0x0f20)
 #define GICD_IROUTER			(0x6000)
+#define GICD_IROUTER_END		(0x7fe0 - 1)
 #define GICD_PIDR2			(0xffe8)
 
 #define GICR_CTLR			(0x0000)
@@ -94,6 +95,28 @@
 #define GICR_NSACR			(0x0e00)
 #define GICR_PIDR2			(0xffe8)
 
+#define GICR_CTLR_ENABLE_LPIS		(1 << 0)
+#define GICR_TYPER_PLPIS		(1 << 0)
+#define GICD_TYPER_LPIS			(1 << 17)
+
+#define GITS_CTLR			(0x0000)
+#define GITS_IIDR			(0x0004)
+#define GITS_TYPER			(0x0008)
+#define GITS_TYPER_HIGH			(0x000c)
+#define GITS_CBASER			(0x0080)
+#define GITS_CBASER_HIGH		(0x0084)
+#define GITS_CWRITER			(0x0088)
+#define GITS_CWRITER_HIGH		(0x008c)
+#define GITS_CREADR			(0x0090)
+#define GITS_CREADR_HIGH		(0x0094)
+#define GITS_BASER			(0x0100)
+#define GITS_PIDR2			(0xffe8)
+#define GITS_TRANSLATER			(0x10040)
+
+#define GITS_CTLR_ENABLED		(1 << 0)
+#define GITS_CTLR_QUIESCENT		(1U << 31)
+#define GITS_CBASER_VALID		(1UL << 63)
+
 #define GICH_VMCR_VENG0			(1 << 0)
 #define GICH_VMCR_VENG1			(1 << 1)
 #define GICH_VMCR_VACKCTL		(1 << 2)
@@ -149,6 +172,7 @@ struct gicv3_context {
 	uint32_t icc_sre_el1;
 	uint32_t ich_vmcr_el2;
 	uint32_t ich_hcr_el2;
+	uint32_t lr_used;
 } __align(sizeof(unsigned long));
 
 struct gic_lr {
@@ -0,0 +1,8 @@
+#ifndef _MINOS_ASM_VFP_H_
+#define _MINOS_ASM_VFP_H_
+
+struct task;
+
+void vfp_access_trap(struct task *task);
+
+#endif
@@ -19,6 +19,8 @@ struct vgic_gicr {
 	uint64_t gicr_typer;
 	uint32_t gicr_ispender;
 	uint32_t gicr_enabler0;
+	uint64_t gicr_propbaser;
+	uint64_t gicr_pendbaser;
 	uint32_t vcpu_id;
 	unsigned long rd_base;
 	unsigned long sgi_base;
@@ -27,10 +29,13 @@ struct vgic_gicr {
 	spinlock_t gicr_lock;
 };
 
+struct vgic_its;
+
 struct vgicv3_dev {
 	struct vdev vdev;
 	struct vgic_gicd gicd;
 	struct vgic_gicr *gicr[NR_CPUS];
+	struct vgic_its *its;
 };
 
 #define GIC_TYPE_GICD		(0x0)
@@ -49,4 +54,12 @@ struct vgicv3_dev {
 
 void vgicv3_send_sgi(struct vcpu *vcpu, unsigned long sgi_value);
 
+int vgicv3_attach_its(struct vm *vm, struct vgic_its *its,
+		unsigned long base, size_t size);
+void vgic_its_inv_lpi(struct vgic_its *its, uint32_t lpi);
+void vgic_its_invall(struct vgic_its *its);
+void vgic_its_set_propbaser(struct vgic_its *its, uint64_t value);
+int vgic_its_send_msi(struct vgic_its *its,
+		uint32_t devid, uint32_t eventid);
+
 #endif
@@ -166,6 +166,15 @@ static void aarch64_system_state_restore(struct task *task, void *c)
 {
 	struct aarch64_system_context *context =
 			(struct aarch64_system_context *)c;
+	uint64_t hcr_el2 = context->hcr_el2 & ~HCR_EL2_TWE;
+
+	/*
+	 * only trap wfe when the pcpu is shared with other
+	 * tasks, then the vcpu which spins on a lock can yield
+	 * the pcpu to the lock holder
+	 */
+	if (pcpu_has_other_ready(get_cpu_var(pcpu)))
+		hcr_el2 |= HCR_EL2_TWE;
 
 	write_sysreg(context->vbar_el1, VBAR_EL1);
 	write_sysreg(context->esr_el1, ESR_EL1);
@@ -173,7 +182,7 @@ static void aarch64_system_state_restore(struct task *task, void *c)
 	write_sysreg(context->vmpidr, VMPIDR_EL2);
 	write_sysreg(context->vpidr, VPIDR_EL2);
 	write_sysreg(context->sctlr_el1, SCTLR_EL1);
-	write_sysreg(context->hcr_el2, HCR_EL2);
+	write_sysreg(hcr_el2, HCR_EL2);
 	write_sysreg(context->sp_el1, SP_EL1);
 	write_sysreg(context->sp_el0, SP_EL0);
 	write_sysreg(context->spsr_el1, SPSR_EL1);
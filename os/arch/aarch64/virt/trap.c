@@ -25,6 +25,7 @@
 #include <minos/irq.h>
 #include <asm/svccc.h>
 #include <asm/vtimer.h>
+#include <asm/vfp.h>
 #include <virt/vdev.h>
 
 extern unsigned char __sync_desc_start;
@@ -49,7 +50,13 @@ static int unknown_handler(gp_regs *reg, uint32_t esr_value)
 
 static int wfi_wfe_handler(gp_regs *reg, uint32_t esr_value)
 {
-	vcpu_idle(get_current_vcpu());
+	struct vcpu *vcpu = get_current_vcpu();
+
+	/* TI bit is 0 means the vcpu is trapped by wfi */
+	if (esr_value & ESR_WFI_WFE_TI)
+		vcpu_yield(vcpu);
+	else
+		vcpu_halt(vcpu);
 
 	return 0;
 }
@@ -105,6 +112,8 @@ static int ldc_stc_cp14_handler(gp_regs *reg, uint32_t esr_value)
 
 static int access_simd_reg_handler(gp_regs *reg, uint32_t esr_value)
 {
+	vfp_access_trap(get_current_task());
+
 	return 0;
 }
 
@@ -212,11 +221,6 @@ static int access_system_reg_handler(gp_regs *reg, uint32_t esr_value)
 	return ret;
 }
 
-static int insabort_tfl_handler(gp_regs *reg, uint32_t esr_value)
-{
-	return 0;
-}
-
 static int insabort_twe_handler(gp_regs *reg, uint32_t esr_value)
 {
 	return 0;
@@ -238,6 +242,33 @@ static inline unsigned long get_faulting_ipa(unsigned long vaddr)
 	return ipa;
 }
 
+static int insabort_tfl_handler(gp_regs *reg, uint32_t esr_value)
+{
+	struct esr_iabt *iabt = (struct esr_iabt *)&esr_value;
+	int ifsc = iabt->ifsc & ~FSC_LL_MASK;
+	unsigned long ipa;
+
+	if (!iabt->s1ptw && (ifsc != FSC_FLT_TRANS)) {
+		pr_info("unsupport instruction abort type this time %d\n",
+				ifsc);
+		inject_virtual_abort();
+		return 0;
+	}
+
+	ipa = get_faulting_ipa(read_sysreg(FAR_EL2));
+	if (vm_mem_fault(get_current_vm(), ipa)) {
+		pr_warn("instruction abort @0x%p vmid:%d\n", ipa,
+				get_vmid(get_current_vcpu()));
+		inject_virtual_abort();
+		return 0;
+	}
+
+	/* the memory is mapped now, run the instruction again */
+	reg->elr_elx -= 4;
+
+	return 0;
+}
+
 static int dataabort_tfl_handler(gp_regs *regs, uint32_t esr_value)
 {
 	int ret;
@@ -253,6 +284,17 @@ static int dataabort_tfl_handler(gp_regs *regs, uint32_t esr_value)
 	else
 		paddr = guest_va_to_ipa(vaddr, 1);
 
+	/*
+	 * the memory of the vm may be allocated on demand, if
+	 * the fault address is a memory block not allocated
+	 * yet, map it and let the vm access it again
+	 */
+	if ((dabt->s1ptw || (dfsc == FSC_FLT_TRANS)) &&
+			!vm_mem_fault(get_current_vm(), paddr)) {
+		regs->elr_elx -= 4;
+		return 0;
+	}
+
 	/*
 	 * dfsc contain the fault type of the dataabort
 	 * now only handle translation fault
@@ -381,7 +423,7 @@ DEFINE_SYNC_DESC(EC_LDC_STC_CP14, EC_TYPE_AARCH32,
 		ldc_stc_cp14_handler, 1, 4);
 
 DEFINE_SYNC_DESC(EC_ACCESS_SIMD_REG, EC_TYPE_BOTH,
-		access_simd_reg_handler, 1, 4);
+		access_simd_reg_handler, 1, 0);
 
 DEFINE_SYNC_DESC(EC_MCR_MRC_CP10, EC_TYPE_AARCH32,
 		mcr_mrc_cp10_handler, 1, 4);
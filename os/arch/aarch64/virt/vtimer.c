@@ -133,6 +133,18 @@ static void vtimer_state_deinit(struct task *task, void *context)
 	del_timer(&c->phy_timer.timer);
 }
 
+/*
+ * the vcpu has been migrated to this pcpu, the pending
+ * timers of it need to expire on this pcpu
+ */
+static void vtimer_state_migrate(struct task *task, void *context)
+{
+	struct vtimer_context *c = (struct vtimer_context *)context;
+
+	migrate_timer(&c->virt_timer.timer);
+	migrate_timer(&c->phy_timer.timer);
+}
+
 static void vtimer_handle_cntp_ctl(gp_regs *regs,
 		int access, int read, unsigned long *value)
 {
@@ -277,6 +289,7 @@ static int vtimer_vmodule_init(struct vmodule *vmodule)
 	vmodule->state_restore = vtimer_state_restore;
 	vmodule->state_deinit = vtimer_state_deinit;
 	vmodule->state_reset = vtimer_state_deinit;
+	vmodule->state_migrate = vtimer_state_migrate;
 	vmodule->valid_for_task = vtimer_valid_for_task;
 	vtimer_vmodule_id = vmodule->id;
 
@@ -18,6 +18,7 @@
 #include <asm/arch.h>
 #include <minos/smp.h>
 #include <minos/irq.h>
+#include <minos/sched.h>
 
 static unsigned long *allsyms_address;
 static unsigned int *allsyms_offset;
@@ -31,6 +32,7 @@ static DEFINE_SPIN_LOCK(dump_lock);
 void dump_stack(gp_regs *regs, unsigned long *stack)
 {
 	unsigned long flags;
+	struct pcpu *pcpu = get_cpu_var(pcpu);
 
 	spin_lock_irqsave(&dump_lock, flags);
 	/*
@@ -40,8 +42,14 @@ void dump_stack(gp_regs *regs, unsigned long *stack)
 	pr_fatal("preempt:%d need_resche:%d os_running:%d\n",
 			preempt_allowed(), need_resched(),
 			os_is_running());
+	pr_fatal("ticks:%lu tick stops:%lu max wakeup lat:%luns\n",
+			pcpu->nr_ticks, pcpu->nr_tick_stops,
+			pcpu->max_wakeup_lat);
 
 	arch_dump_stack(regs, stack);
+
+	/* the call trace is printed by pr_err, send it out now */
+	log_flush_panic();
 	spin_unlock_irqrestore(&dump_lock, flags);
 }
 
@@ -56,10 +64,10 @@ static void panic_other_cpu(void *data)
 
 void __panic(gp_regs *regs, char *fmt, ...)
 {
-	int cpu;
 	va_list arg;
 	int printed;
 	char buffer[512];
+	cpumask_t mask;
 
 	/*
 	 * disable local irq panic will directly called
@@ -77,13 +85,12 @@ void __panic(gp_regs *regs, char *fmt, ...)
 	pr_fatal("[Panic] : %s", buffer);
 	dump_stack(regs, NULL);
 
-	/* inform other cpu to do panic */
-	for (cpu = 0; cpu < NR_CPUS; cpu++) {
-		if (cpu == smp_processor_id())
-			continue;
+	/* inform other cpu to do panic by one multicast call */
+	mask = cpu_online;
+	cpumask_clear_cpu(smp_processor_id(), &mask);
+	smp_function_call_many_async(&mask, panic_other_cpu, NULL);
 
-		smp_function_call(cpu, panic_other_cpu, NULL, 0);
-	}
+	log_flush_panic();
 
 	for (;;)
 		cpu_relax();
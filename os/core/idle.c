@@ -31,6 +31,7 @@ extern void apps_cpu5_init(void);
 extern void apps_cpu6_init(void);
 extern void apps_cpu7_init(void);
 extern void os_init(void);
+extern void sched_tick_disable(void);
 
 static void create_static_tasks(void)
 {
@@ -86,6 +87,21 @@ static inline bool pcpu_can_idle(struct pcpu *pcpu)
 	return true;
 }
 
+/*
+ * no percpu task can run on the idle pcpu, the sched
+ * tick is not needed, it will be armed again when
+ * a task is waked up on this pcpu
+ */
+static inline void pcpu_stop_tick(struct pcpu *pcpu)
+{
+	if (pcpu->tick_stopped)
+		return;
+
+	sched_tick_disable();
+	pcpu->tick_stopped = 1;
+	pcpu->nr_tick_stops++;
+}
+
 static void os_clean(void)
 {
 	/* recall the memory for init function and data */
@@ -154,8 +170,12 @@ void cpu_idle(void)
 		 * state to avoid the interrupt happend before wfi
 		 */
 		while (!need_resched() && pcpu_can_idle(pcpu)) {
+			/* send the pending log to the console */
+			log_flush();
+
 			local_irq_disable();
 			if (pcpu_can_idle(pcpu)) {
+				pcpu_stop_tick(pcpu);
 				pcpu->state = PCPU_STATE_IDLE;
 				wfi();
 				nop();
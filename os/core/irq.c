@@ -57,6 +57,18 @@ void send_sgi(uint32_t sgi, int cpu)
 	irq_chip->send_sgi(sgi, SGI_TO_LIST, &mask);
 }
 
+/*
+ * send the sgi to all the cpus in the mask, the irq
+ * chip can send it to a group of cpus in one request
+ */
+void send_sgi_mask(uint32_t sgi, cpumask_t *mask)
+{
+	if (sgi >= 16)
+		return;
+
+	irq_chip->send_sgi(sgi, SGI_TO_LIST, mask);
+}
+
 static int do_handle_host_irq(struct irq_desc *irq_desc)
 {
 	uint32_t cpuid = smp_processor_id();
@@ -163,6 +163,33 @@ static LIST_HEAD(host_list);
 #define FREE_POOL_OFFSET		(2)
 #define CACHE_POOL_OFFSET		(1)
 
+/*
+ * each cpu has a magazine for every 16..512 byte slab
+ * class, malloc and free of these classes are handled
+ * in the local magazine without the slab lock, only
+ * when the magazine is empty or full, it will refill
+ * or drain SLAB_MAGAZINE_BATCH slabs from the shared
+ * slab pool at one time
+ */
+#define SLAB_MAGAZINE_CLASSES		(512 >> SLAB_MIN_DATA_SIZE_SHIFT)
+#define SLAB_MAGAZINE_SIZE		(CONFIG_SLAB_MAGAZINE_SIZE)
+#define SLAB_MAGAZINE_BATCH		(SLAB_MAGAZINE_SIZE / 2)
+
+struct slab_magazine {
+	int nr;
+	struct slab_header *slabs[SLAB_MAGAZINE_SIZE];
+};
+
+struct slab_cache {
+	struct slab_magazine mags[SLAB_MAGAZINE_CLASSES];
+	unsigned long hit;
+	unsigned long miss;
+	unsigned long refill;
+	unsigned long drain;
+};
+
+static DEFINE_PER_CPU(struct slab_cache, slab_cache);
+
 static int inline add_page_section(phy_addr_t base, size_t size)
 {
 	struct mem_section *ms;
@@ -1158,18 +1185,13 @@ static slab_alloc_func alloc_func[] = {
 	NULL,
 };
 
-void *malloc(size_t size)
+/* need to be called with the pslab->lock held */
+static void *__malloc(size_t size)
 {
 	int i = 0;
 	void *ret = NULL;
 	slab_alloc_func func;
 
-	if (size == 0)
-		return NULL;
-
-	size = get_slab_alloc_size(size);
-	spin_lock(&pslab->lock);
-
 	while (1) {
 		func = alloc_func[i];
 		if (!func)
@@ -1181,6 +1203,131 @@ void *malloc(size_t size)
 		i++;
 	}
 
+	return ret;
+}
+
+static void slab_magazine_refill(struct slab_magazine *mag, int id)
+{
+	struct slab_pool *pool = &pslab->pool[id];
+
+	while (pool->head && (mag->nr < SLAB_MAGAZINE_BATCH)) {
+		mag->slabs[mag->nr] = get_slab_from_slab_pool(pool);
+		mag->slabs[mag->nr]->next = NULL;
+		mag->nr++;
+	}
+}
+
+static void slab_magazine_drain(struct slab_magazine *mag, int id)
+{
+	struct slab_pool *pool = &pslab->pool[id];
+
+	while (mag->nr > SLAB_MAGAZINE_BATCH) {
+		mag->nr--;
+		add_slab_to_slab_pool(mag->slabs[mag->nr], pool);
+	}
+}
+
+/*
+ * when the magazine is empty and the shared pool can not
+ * refill it, the slab is allocated by the slow path in
+ * the same lock hold instead of taking the lock again
+ */
+static void *malloc_from_magazine(size_t size, int id)
+{
+	struct slab_cache *sc;
+	struct slab_magazine *mag;
+	struct slab_header *header;
+	unsigned long flags;
+	void *ret;
+
+	local_irq_save(flags);
+
+	sc = &get_cpu_var(slab_cache);
+	mag = &sc->mags[id];
+
+	if (mag->nr) {
+		sc->hit++;
+	} else {
+		sc->miss++;
+		spin_lock(&pslab->lock);
+		slab_magazine_refill(mag, id);
+		if (mag->nr) {
+			sc->refill++;
+		} else {
+			ret = __malloc(size);
+			spin_unlock(&pslab->lock);
+			local_irq_restore(flags);
+			return ret;
+		}
+		spin_unlock(&pslab->lock);
+	}
+
+	header = mag->slabs[--mag->nr];
+	header->magic = SLAB_MAGIC;
+	local_irq_restore(flags);
+
+	return SLAB_HEADER_TO_ADDR(header);
+}
+
+static int free_to_magazine(struct slab_header *header)
+{
+	int id = slab_pool_id(header->size);
+	struct slab_cache *sc;
+	struct slab_magazine *mag;
+	unsigned long flags;
+
+	if (id >= SLAB_MAGAZINE_CLASSES)
+		return 0;
+
+	local_irq_save(flags);
+
+	sc = &get_cpu_var(slab_cache);
+	mag = &sc->mags[id];
+
+	if (mag->nr == SLAB_MAGAZINE_SIZE) {
+		spin_lock(&pslab->lock);
+		slab_magazine_drain(mag, id);
+		spin_unlock(&pslab->lock);
+		sc->drain++;
+	}
+
+	/* clear the magic, double free will be detected */
+	header->next = NULL;
+	mag->slabs[mag->nr++] = header;
+
+	local_irq_restore(flags);
+
+	return 1;
+}
+
+void dump_slab_cache_stat(void)
+{
+	int cpu;
+	struct slab_cache *sc;
+
+	for_each_online_cpu(cpu) {
+		sc = &get_per_cpu(slab_cache, cpu);
+		pr_info("slab cache cpu%d hit:%lu miss:%lu refill:%lu drain:%lu\n",
+				cpu, sc->hit, sc->miss, sc->refill, sc->drain);
+	}
+}
+
+void *malloc(size_t size)
+{
+	int id;
+	void *ret;
+
+	if (size == 0)
+		return NULL;
+
+	size = get_slab_alloc_size(size);
+
+	id = slab_pool_id(size);
+	if (id < SLAB_MAGAZINE_CLASSES)
+		return malloc_from_magazine(size, id);
+
+	spin_lock(&pslab->lock);
+	ret = __malloc(size);
 	spin_unlock(&pslab->lock);
 
 	return ret;
@@ -1358,6 +1505,9 @@ free_slab:
 		return;
 	}
 
+	if (free_to_magazine(header))
+		return;
+
 	/* big slab will default push to free cache pool */
 	spin_lock(&pslab->lock);
 	id = slab_pool_id(header->size);
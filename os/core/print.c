@@ -25,15 +25,425 @@
 #include <minos/time.h>
 #include <minos/task.h>
 #include <minos/sched.h>
+#include <minos/atomic.h>
+#include <minos/errno.h>
+#include <minos/timer.h>
+#include <minos/init.h>
+#include <asm/barrier.h>
 
 #ifndef CONFIG_LOG_LEVEL
 #define CONFIG_LOG_LEVEL	PRINT_LEVEL_INFO
 #endif
 
+#ifndef CONFIG_LOG_BUF_SHIFT
+#define CONFIG_LOG_BUF_SHIFT	14
+#endif
+
+#ifndef CONFIG_LOG_FLUSH_PERIOD
+#define CONFIG_LOG_FLUSH_PERIOD	50
+#endif
+
+#define LOG_BUF_SIZE		(1UL << CONFIG_LOG_BUF_SHIFT)
+#define LOG_BUF_MASK		(LOG_BUF_SIZE - 1)
+#define LOG_PANIC_SPIN		(1000000)
+#define LOG_HIGH_WATER		(LOG_BUF_SIZE - (LOG_BUF_SIZE >> 2))
+#define LOG_LOW_WATER		(LOG_BUF_SIZE >> 1)
+#define LOG_TIMER_BATCH		(32)
+
 extern struct task *__current_tasks[NR_CPUS];
 
-static DEFINE_SPIN_LOCK(print_lock);
+/*
+ * each log message is stored as a record in the ring
+ * of the cpu which generated it, the size of a record
+ * is 8 bytes aligned so the header will never wrap
+ * around the end of the buffer, only the text will
+ */
+struct log_record {
+	uint32_t seq;
+	uint16_t len;
+	uint16_t size;
+};
+
+/*
+ * per cpu log ring, only the owner cpu write to the
+ * ring with its local irq disabled, so no lock is
+ * needed for the producer side
+ *
+ * head    - the position the next record will be stored
+ * tail    - the oldest record which still in the ring
+ * con     - the next record need to send to the console
+ *
+ * head and tail are updated by the owner cpu, con is
+ * updated by the cpu which is draining the log
+ */
+struct log_ring {
+	unsigned long head;
+	unsigned long tail;
+	unsigned long con;
+	unsigned long dropped;
+	unsigned long dropped_report;
+	char buf[LOG_BUF_SIZE];
+};
+
+static DEFINE_PER_CPU(struct log_ring, log_ring);
+static atomic_t log_seq = ATOMIC_INIT(0);
+static atomic_t log_draining = ATOMIC_INIT(0);
 static unsigned int print_level = CONFIG_LOG_LEVEL;
+static struct timer_list log_timer;
+
+static inline struct log_record *log_record(struct log_ring *ring,
+		unsigned long pos)
+{
+	return (struct log_record *)&ring->buf[pos & LOG_BUF_MASK];
+}
+
+static void log_ring_write(struct log_ring *ring, unsigned long pos,
+		char *src, size_t size)
+{
+	unsigned long off = pos & LOG_BUF_MASK;
+	size_t first = LOG_BUF_SIZE - off;
+
+	if (first >= size) {
+		memcpy(&ring->buf[off], src, size);
+	} else {
+		memcpy(&ring->buf[off], src, first);
+		memcpy(ring->buf, src + first, size - first);
+	}
+}
+
+static void log_ring_read(struct log_ring *ring, unsigned long pos,
+		char *dst, size_t size)
+{
+	unsigned long off = pos & LOG_BUF_MASK;
+	size_t first = LOG_BUF_SIZE - off;
+
+	if (first >= size) {
+		memcpy(dst, &ring->buf[off], size);
+	} else {
+		memcpy(dst, &ring->buf[off], first);
+		memcpy(dst + first, ring->buf, size - first);
+	}
+}
+
+static int log_store(char *text, int len)
+{
+	struct log_ring *ring;
+	struct log_record *rec;
+	unsigned long flags, size;
+
+	if (len > (LOG_BUF_SIZE >> 2))
+		len = LOG_BUF_SIZE >> 2;
+	size = BALIGN(sizeof(struct log_record) + len, sizeof(uint64_t));
+
+	local_irq_save(flags);
+	ring = &get_cpu_var(log_ring);
+
+	/*
+	 * the console has not catch up, drop the new message
+	 * instead of overwrite the one which has not been
+	 * sent out, the drainer will report how many message
+	 * has been lost
+	 */
+	if (ring->head + size - ring->con > LOG_BUF_SIZE) {
+		ring->dropped++;
+		local_irq_restore(flags);
+		return -ENOSPC;
+	}
+
+	/* release the oldest records which already on the console */
+	while (ring->head + size - ring->tail > LOG_BUF_SIZE)
+		ring->tail += log_record(ring, ring->tail)->size;
+	smp_wmb();
+
+	rec = log_record(ring, ring->head);
+	rec->seq = atomic_inc_return(&log_seq);
+	rec->len = len;
+	rec->size = size;
+	log_ring_write(ring, ring->head + sizeof(struct log_record), text, len);
+
+	/* make the record visible before the head is updated */
+	smp_wmb();
+	ring->head += size;
+	local_irq_restore(flags);
+
+	return 0;
+}
+
+/*
+ * find the cpu which has the oldest record that not
+ * sent to the console, the global sequence number keeps
+ * the message in the order they are generated
+ */
+static struct log_ring *log_next_ring(void)
+{
+	int cpu;
+	uint32_t seq = 0;
+	struct log_ring *ring, *next = NULL;
+	struct log_record *rec;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		ring = &get_per_cpu(log_ring, cpu);
+		if (ring->con == ring->head)
+			continue;
+
+		smp_rmb();
+		rec = log_record(ring, ring->con);
+		if (!next || ((int32_t)(rec->seq - seq) < 0)) {
+			next = ring;
+			seq = rec->seq;
+		}
+	}
+
+	return next;
+}
+
+static void log_report_dropped(int cpu, struct log_ring *ring)
+{
+	int i, len;
+	char buf[64];
+	unsigned long dropped = ring->dropped;
+
+	if (dropped == ring->dropped_report)
+		return;
+
+	len = sprintf(buf, "** %d log messages dropped on cpu%d **\n",
+			(int)(dropped - ring->dropped_report), cpu);
+	for (i = 0; i < len; i++)
+		serial_putc(buf[i]);
+
+	ring->dropped_report = dropped;
+}
+
+static void log_ring_flush(struct log_ring *ring)
+{
+	int i;
+	unsigned long pos;
+	struct log_record *rec;
+
+	rec = log_record(ring, ring->con);
+	pos = ring->con + sizeof(struct log_record);
+
+	for (i = 0; i < rec->len; i++)
+		serial_putc(ring->buf[(pos + i) & LOG_BUF_MASK]);
+
+	/* the space can be reused by the producer after here */
+	smp_mb();
+	ring->con += rec->size;
+}
+
+static void __log_flush(int idle)
+{
+	int cpu;
+	struct log_ring *ring;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		log_report_dropped(cpu, &get_per_cpu(log_ring, cpu));
+
+	while ((ring = log_next_ring())) {
+		log_ring_flush(ring);
+		if (idle && need_resched())
+			break;
+	}
+}
+
+static inline int log_drain_trylock(void)
+{
+	if (atomic_add_return_old(1, &log_draining) == 0)
+		return 1;
+
+	atomic_sub(1, &log_draining);
+	return 0;
+}
+
+static inline void log_drain_unlock(void)
+{
+	atomic_sub(1, &log_draining);
+}
+
+/*
+ * called by the idle task, only one cpu will send the
+ * log to the console at the same time, others just
+ * return and go to idle
+ */
+void log_flush(void)
+{
+	if (!log_drain_trylock())
+		return;
+
+	__log_flush(1);
+	log_drain_unlock();
+}
+
+/*
+ * synchronous flush used before the os is running and
+ * for the fatal message, when panic the cpu which is
+ * draining may never release the console, so after a
+ * while take over the console anyway
+ */
+static void log_flush_sync(int panic)
+{
+	unsigned long flags;
+	int locked, spin = 0;
+
+	local_irq_save(flags);
+	while (!(locked = log_drain_trylock())) {
+		if (panic && (++spin > LOG_PANIC_SPIN))
+			break;
+		cpu_relax();
+	}
+
+	__log_flush(0);
+
+	if (locked)
+		log_drain_unlock();
+	local_irq_restore(flags);
+}
+
+/*
+ * called on the fatal path such as dump_stack and panic,
+ * the pr_err messages which print the call trace are only
+ * queued, they need to be sent out before the cpu halts
+ */
+void log_flush_panic(void)
+{
+	log_flush_sync(1);
+}
+
+/*
+ * a busy pcpu may never go to the idle loop, when its
+ * ring is nearly full send the pending log to the console
+ * from here until the ring is back under the low water
+ * mark, if other cpu is draining just leave it to it
+ */
+static void log_flush_high_water(void)
+{
+	unsigned long flags;
+	struct log_ring *ring, *next;
+
+	local_irq_save(flags);
+	ring = &get_cpu_var(log_ring);
+	if ((ring->head - ring->con) < LOG_HIGH_WATER)
+		goto out;
+
+	if (!log_drain_trylock())
+		goto out;
+
+	while ((ring->head - ring->con) > LOG_LOW_WATER) {
+		next = log_next_ring();
+		if (!next)
+			break;
+		log_ring_flush(next);
+	}
+
+	log_drain_unlock();
+out:
+	local_irq_restore(flags);
+}
+
+/*
+ * the pcpus which are always busy never go to the idle
+ * loop, so the rings are also drained by a timer, only
+ * a few records are sent out each time since it runs in
+ * the irq context
+ */
+static void log_timer_handler(unsigned long data)
+{
+	int cpu, nr = 0;
+	struct log_ring *ring;
+
+	if (log_drain_trylock()) {
+		for (cpu = 0; cpu < NR_CPUS; cpu++)
+			log_report_dropped(cpu, &get_per_cpu(log_ring, cpu));
+
+		while ((nr++ < LOG_TIMER_BATCH) && (ring = log_next_ring()))
+			log_ring_flush(ring);
+
+		log_drain_unlock();
+	}
+
+	mod_timer(&log_timer, NOW() + MILLISECS(CONFIG_LOG_FLUSH_PERIOD));
+}
+
+static int log_timer_init(void)
+{
+	init_timer_on_cpu(&log_timer, 0);
+	log_timer.function = log_timer_handler;
+	mod_timer(&log_timer, NOW() + MILLISECS(CONFIG_LOG_FLUSH_PERIOD));
+
+	return 0;
+}
+module_initcall(log_timer_init);
+
+/*
+ * copy the log history which still in the rings to the
+ * buffer, if the buffer is not big enough the oldest
+ * message will be skipped, return the bytes copied
+ */
+size_t log_read_history(char *buf, size_t size)
+{
+	int cpu, pass;
+	uint32_t seq = 0;
+	size_t total = 0, skip = 0, copied = 0;
+	unsigned long pos[NR_CPUS], head[NR_CPUS];
+	struct log_ring *ring;
+	struct log_record *rec;
+	int next;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (cpu = 0; cpu < NR_CPUS; cpu++) {
+			ring = &get_per_cpu(log_ring, cpu);
+			head[cpu] = ring->head;
+			pos[cpu] = ring->tail;
+		}
+		smp_rmb();
+
+		if (pass == 1 && total > size)
+			skip = total - size;
+
+		while (1) {
+			next = -1;
+			for (cpu = 0; cpu < NR_CPUS; cpu++) {
+				if ((long)(head[cpu] - pos[cpu]) <= 0)
+					continue;
+
+				rec = log_record(&get_per_cpu(log_ring, cpu), pos[cpu]);
+				if ((next < 0) || ((int32_t)(rec->seq - seq) < 0)) {
+					next = cpu;
+					seq = rec->seq;
+				}
+			}
+
+			if (next < 0)
+				break;
+
+			ring = &get_per_cpu(log_ring, next);
+			rec = log_record(ring, pos[next]);
+			if ((rec->size == 0) || (rec->size > LOG_BUF_SIZE)) {
+				pos[next] = head[next];
+				continue;
+			}
+
+			if (pass == 0) {
+				total += rec->len;
+			} else if (skip >= rec->len) {
+				skip -= rec->len;
+			} else if (copied + rec->len <= size) {
+				log_ring_read(ring, pos[next] +
+						sizeof(struct log_record),
+						buf + copied, rec->len);
+
+				/* the record is overwritten during copy */
+				smp_rmb();
+				if ((long)(ring->tail - pos[next]) <= 0)
+					copied += rec->len;
+			}
+
+			pos[next] += rec->size;
+		}
+	}
+
+	return copied;
+}
 
 static int get_print_time(char *buffer)
 {
@@ -82,10 +492,9 @@ void change_log_level(unsigned int level)
 int level_print(int level, char *fmt, ...)
 {
 	va_list arg;
-	int printed, i, cpuid;
+	int printed, cpuid;
 	char buf[512];
 	char *buffer = buf;
-	unsigned long flags;
 	int pid;
 	struct task *task;
 
@@ -131,10 +540,20 @@ int level_print(int level, char *fmt, ...)
 	printed += vsprintf(buffer, fmt, arg);
 	va_end(arg);
 
-	spin_lock_irqsave(&print_lock, flags);
-	for(i = 0; i < printed; i++)
-		serial_putc(buf[i]);
-	spin_unlock_irqrestore(&print_lock, flags);
+	if (printed > sizeof(buf))
+		printed = sizeof(buf);
+
+	log_store(buf, printed);
+
+	/*
+	 * before the os is running there is no idle loop
+	 * to drain the log, and the error and fatal message
+	 * need to be seen at once, the system may die soon
+	 */
+	if ((level <= PRINT_LEVEL_ERROR) || !os_is_running())
+		log_flush_sync(level == PRINT_LEVEL_FATAL);
+	else
+		log_flush_high_water();
 
 	return printed;
 }
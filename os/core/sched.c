@@ -21,6 +21,7 @@
 #include <minos/softirq.h>
 #include <minos/vmodule.h>
 #include <minos/of.h>
+#include <minos/cpumask.h>
 
 #ifdef CONFIG_VIRT
 #include <virt/vm.h>
@@ -28,9 +29,27 @@
 
 DEFINE_SPIN_LOCK(__kernel_lock);
 
-static prio_t os_rdy_grp;
-static uint64_t __os_rdy_table;
-static uint8_t *os_rdy_table;
+/*
+ * each pcpu which using the global sched class has
+ * its own realtime run queue, the bit n of the ready
+ * map is set when the realtime task whose prio is n is
+ * ready on this pcpu. the running realtime task is also
+ * kept in the ready map. the lock of the run queue is
+ * held from the task pick to the task switch out, a task
+ * which is running or going to run on a pcpu will not be
+ * migrated to other pcpu.
+ */
+struct rt_rq {
+	spinlock_t lock;
+	uint64_t ready_map;
+	int nr_ready;
+} __align_cache_line;
+
+static struct rt_rq rt_rqs[NR_CPUS];
+
+/* the pcpus which have more than one realtime task ready */
+static cpumask_t rt_overload_mask;
+
 prio_t os_highest_rdy[NR_CPUS];
 prio_t os_prio_cur[NR_CPUS]; 
 
@@ -46,8 +65,57 @@ struct task *__next_tasks[NR_CPUS];
 
 #define SCHED_CLASS_LOCAL	0
 #define SCHED_CLASS_GLOBAL	1
+#define SCHED_CLASS_FAIR	2
 static int pcpu_sched_class[NR_CPUS];
 
+#ifndef CONFIG_SCHED_LATENCY
+#define CONFIG_SCHED_LATENCY		20
+#endif
+
+#ifndef CONFIG_SCHED_MIN_GRANULARITY
+#define CONFIG_SCHED_MIN_GRANULARITY	2
+#endif
+
+#define SCHED_CAP_PERIOD		MILLISECS(100)
+
+/*
+ * fair sched class, the percpu task which has the
+ * smallest vruntime will run next, the run time slice
+ * is the sched latency divided by the number of the
+ * ready tasks. a task whose cap is used up in the
+ * current period will not run until next period
+ */
+struct fair_rq {
+	uint64_t min_vruntime;
+	unsigned long period_start;
+	unsigned long slice;
+	struct timer_list period_timer;
+};
+
+static struct fair_rq fair_rqs[NR_CPUS];
+
+#ifdef CONFIG_VIRT
+#ifndef CONFIG_SCHED_BALANCE_PERIOD
+#define CONFIG_SCHED_BALANCE_PERIOD	100
+#endif
+
+/*
+ * the vcpus are balanced when the load of the busiest
+ * pcpu is higher than the idlest one by more than one
+ * and a half runnable task, so moving one vcpu always
+ * makes the pcpus more balanced
+ */
+#define SCHED_BALANCE_THRESHOLD		(SCHED_LOAD_SCALE * 3 / 2)
+
+static struct timer_list balance_timer;
+
+#ifndef CONFIG_SCHED_GANG_SLICE
+#define CONFIG_SCHED_GANG_SLICE		10
+#endif
+
+#define SCHED_GANG_SLICE		MILLISECS(CONFIG_SCHED_GANG_SLICE)
+#endif
+
 extern void sched_tick_disable(void);
 extern void sched_tick_enable(unsigned long exp);
 
@@ -62,24 +130,126 @@ void pcpu_resched(int pcpu_id)
 	send_sgi(CONFIG_MINOS_RESCHED_IRQ, pcpu_id);
 }
 
-static void smp_set_task_ready(void *data)
+#ifdef CONFIG_VIRT
+static inline int task_gang_active(struct task *task, unsigned long now)
 {
-	struct task *task = data;
-	struct pcpu *pcpu = get_cpu_var(pcpu);
-	
+	struct vm *vm;
+
+	if (!task_is_vcpu(task))
+		return 0;
+
+	vm = task_to_vm(task);
+
+	return ((vm->flags & VM_FLAGS_GANG_SCHED) && (now < vm->gang_expires));
+}
+
+/*
+ * gang sched, when a vcpu of the gang vm is going to
+ * run and the gang is not active, start a gang slice
+ * and resched the pcpus of the ready siblings, these
+ * pcpus will pick the siblings first until the slice
+ * ends. the slice of each vcpu in the gang ends at the
+ * same time. a new gang slice can only start after one
+ * slice since the last one ends, other tasks on the
+ * pcpus of the siblings can run in this time. the pcpu
+ * whose sibling is not ready runs other tasks.
+ */
+static void gang_switch_to(struct task *next, unsigned long now)
+{
+	struct vcpu *vcpu, *tmp;
+	struct vm *vm;
+	unsigned long left;
+	int start = 0;
+
+	if (!task_is_vcpu(next))
+		return;
+
+	vcpu = task_to_vcpu(next);
+	vm = vcpu->vm;
+	if (!(vm->flags & VM_FLAGS_GANG_SCHED))
+		return;
+
+	if (now >= vm->gang_expires + SCHED_GANG_SLICE) {
+		spin_lock(&vm->gang_lock);
+		if (now >= vm->gang_expires + SCHED_GANG_SLICE) {
+			vm->gang_expires = now + SCHED_GANG_SLICE;
+			vm->nr_gang_slices++;
+			start = 1;
+		}
+		spin_unlock(&vm->gang_lock);
+	}
+
+	if (start) {
+		vm_for_each_vcpu(vm, tmp) {
+			if ((tmp != vcpu) && (tmp->task->stat == TASK_STAT_RDY))
+				pcpu_resched(tmp->task->affinity);
+		}
+	}
+
+	if (now < vm->gang_expires) {
+		left = (vm->gang_expires - now + MILLISECS(1) - 1) / MILLISECS(1);
+		if (left < next->run_time)
+			next->run_time = left;
+	}
+}
+#else
+static inline int task_gang_active(struct task *task, unsigned long now)
+{
+	return 0;
+}
+
+static inline void gang_switch_to(struct task *next, unsigned long now)
+{
+
+}
+#endif
+
+static inline int task_migrating(struct task *task)
+{
+	return (task->migrate_to != PCPU_AFF_NONE);
+}
+
+/*
+ * the task has left its old pcpu and is waiting on the
+ * new list of its new pcpu, the stat list of it will be
+ * updated when it arrives the new pcpu
+ */
+static inline int task_in_transit(struct task *task)
+{
+	return (task->migrate_to == task->affinity);
+}
+
+static void queue_remote_wakeup(struct task *task)
+{
+	struct pcpu *pcpu = get_per_cpu(pcpu, task->affinity);
+
+	set_bit(task->pid, pcpu->wake_map);
+	if (atomic_inc_return_old(&pcpu->wake_kick) == 0)
+		pcpu_resched(pcpu->pcpu_id);
+}
+
+static void remote_wakeup(struct pcpu *pcpu, struct task *task)
+{
+	/* the task has been migrated to other pcpu */
+	if (task->affinity != pcpu->pcpu_id) {
+		queue_remote_wakeup(task);
+		return;
+	}
+
 	/*
 	 * current is the task, means the task has already
-	 * set to ready stat, there may some mistake that
-	 * make this case happend, need to check
+	 * run, or the task is suspended again before the
+	 * wakeup is handled
 	 */
-	if ((current == task) || !task_is_ready(task)) {
-		pr_warn("%s wrong stat %d\n", __func__, task->stat);
+	if ((current == task) || !task_is_ready(task))
 		return;
-	}
 
-	list_del(&task->stat_list);
-	list_add_tail(&pcpu->ready_list, &task->stat_list);
-	pcpu->local_rdy_tasks++;
+	if (!task_in_transit(task)) {
+		list_del(&task->stat_list);
+		list_add_tail(&pcpu->ready_list, &task->stat_list);
+		pcpu->local_rdy_tasks++;
+		task->wakeup_ns = NOW();
+	}
 
 	if (task->delay) {
 		del_timer(&task->delay_timer);
@@ -89,16 +259,51 @@ static void smp_set_task_ready(void *data)
 	set_need_resched();
 }
 
+/*
+ * the wake map is only drained by its own pcpu, clear
+ * the kick first, then the waker which set the bit
+ * after this will send a new resched sgi
+ */
+static void drain_remote_wakeups(struct pcpu *pcpu)
+{
+	struct task *task;
+	int pid;
+
+	if (atomic_read(&pcpu->wake_kick) == 0)
+		return;
+
+	atomic_set(&pcpu->wake_kick, 0);
+	mb();
+
+	for_each_set_bit(pid, pcpu->wake_map, OS_NR_TASKS) {
+		if (!test_and_clear_bit(pid, pcpu->wake_map))
+			continue;
+
+		task = pid_to_task(pid);
+		if (task && task_is_percpu(task))
+			remote_wakeup(pcpu, task);
+	}
+}
+
 static void smp_set_task_suspend(void *data)
 {
 	struct task *task = data;
 	struct pcpu *pcpu = get_cpu_var(pcpu);
+
+	if (task->affinity != pcpu->pcpu_id) {
+		smp_function_call(task->affinity, smp_set_task_suspend,
+				(void *)task, 0);
+		return;
+	}
 	
 	if ((current == task) || task_is_ready(task)) {
 		pr_warn("%s wrong stat %d\n", __func__, task->stat);
 		return;
 	}
 
+	if (task_in_transit(task))
+		return;
+
 	/* 
 	 * fix me - when the task is pending to wait
 	 * a mutex or sem, how to deal ?
@@ -108,40 +313,287 @@ static void smp_set_task_suspend(void *data)
 	pcpu->local_rdy_tasks--;
 }
 
+static inline int task_on_cpu(struct task *task, int cpu)
+{
+	return ((__current_tasks[cpu] == task) ||
+			(__next_tasks[cpu] == task));
+}
+
+static inline prio_t rt_rq_highest(struct rt_rq *rq)
+{
+	if (rq->ready_map == 0)
+		return OS_PRIO_PCPU;
+
+	return (prio_t)__ffs64(rq->ready_map);
+}
+
+static inline void rt_rq_update_overload(int cpu, struct rt_rq *rq)
+{
+	if (rq->nr_ready > 1)
+		cpumask_set_cpu(cpu, &rt_overload_mask);
+	else
+		cpumask_clear_cpu(cpu, &rt_overload_mask);
+}
+
+static void __rt_enqueue_task(int cpu, struct task *task)
+{
+	struct rt_rq *rq = &rt_rqs[cpu];
+
+	rq->ready_map |= (1UL << task->prio);
+	rq->nr_ready++;
+	task->cpu = cpu;
+	rt_rq_update_overload(cpu, rq);
+}
+
+static void __rt_dequeue_task(int cpu, struct task *task)
+{
+	struct rt_rq *rq = &rt_rqs[cpu];
+
+	if (!(rq->ready_map & (1UL << task->prio)))
+		return;
+
+	rq->ready_map &= ~(1UL << task->prio);
+	rq->nr_ready--;
+	rt_rq_update_overload(cpu, rq);
+}
+
+/*
+ * lock the run queue which the task is queued on, the
+ * task may be pulled by other pcpu before the lock is
+ * got, so need to check it again after locked
+ */
+static struct rt_rq *task_rt_rq_lock(struct task *task)
+{
+	int cpu;
+	struct rt_rq *rq;
+
+	for (;;) {
+		cpu = task->cpu;
+		rq = &rt_rqs[cpu];
+		raw_spin_lock(&rq->lock);
+		if (task->cpu == cpu)
+			return rq;
+		raw_spin_unlock(&rq->lock);
+	}
+}
+
+static void rt_double_lock(int cpu1, int cpu2)
+{
+	if (cpu1 < cpu2) {
+		raw_spin_lock(&rt_rqs[cpu1].lock);
+		raw_spin_lock(&rt_rqs[cpu2].lock);
+	} else {
+		raw_spin_lock(&rt_rqs[cpu2].lock);
+		raw_spin_lock(&rt_rqs[cpu1].lock);
+	}
+}
+
+static void rt_double_unlock(int cpu1, int cpu2)
+{
+	raw_spin_unlock(&rt_rqs[cpu1].lock);
+	raw_spin_unlock(&rt_rqs[cpu2].lock);
+}
+
+/*
+ * the prio of the task running on the pcpu, the idle
+ * pcpu is treated as lower than the pcpu running a
+ * percpu task
+ */
+static inline prio_t pcpu_running_prio(int cpu)
+{
+	prio_t prio = os_prio_cur[cpu];
+
+	if ((prio == OS_PRIO_PCPU) && task_is_idle(__current_tasks[cpu]))
+		prio = OS_PRIO_IDLE;
+
+	return prio;
+}
+
+/*
+ * select the pcpu for the realtime task which is going
+ * to be ready, if the task is still on its last pcpu or
+ * it can preempt the last pcpu, keep it on the same pcpu,
+ * otherwise find the pcpu which is running the lowest
+ * prio task
+ */
+static int rt_select_cpu(struct task *task)
+{
+	int cpu, best = -1;
+	prio_t prio, lowest = task->prio;
+
+	cpu = task->cpu;
+	if (pcpu_sched_class[cpu] == SCHED_CLASS_GLOBAL) {
+		if (task_on_cpu(task, cpu) ||
+				(pcpu_running_prio(cpu) > task->prio))
+			return cpu;
+	}
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (pcpu_sched_class[cpu] != SCHED_CLASS_GLOBAL)
+			continue;
+
+		prio = pcpu_running_prio(cpu);
+		if (prio > lowest) {
+			lowest = prio;
+			best = cpu;
+		}
+	}
+
+	if (best >= 0)
+		return best;
+
+	/* no pcpu can run it now, queue it on the last pcpu */
+	cpu = task->cpu;
+	if (pcpu_sched_class[cpu] == SCHED_CLASS_GLOBAL)
+		return cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (pcpu_sched_class[cpu] == SCHED_CLASS_GLOBAL)
+			return cpu;
+	}
+
+	return 0;
+}
+
+static void rt_set_task_ready(struct task *task)
+{
+	int cpu;
+	struct rt_rq *rq;
+
+	/* the task is already on a run queue */
+	rq = task_rt_rq_lock(task);
+	if (rq->ready_map & (1UL << task->prio)) {
+		raw_spin_unlock(&rq->lock);
+		return;
+	}
+	raw_spin_unlock(&rq->lock);
+
+	/*
+	 * the task is not on any run queue and the caller
+	 * holds the task lock, so only this pcpu can put
+	 * it to a run queue
+	 */
+	cpu = rt_select_cpu(task);
+	rq = &rt_rqs[cpu];
+	raw_spin_lock(&rq->lock);
+	__rt_enqueue_task(cpu, task);
+	raw_spin_unlock(&rq->lock);
+
+	if (cpu == smp_processor_id())
+		set_need_resched();
+	else if (task->prio < os_prio_cur[cpu])
+		pcpu_resched(cpu);
+}
+
+static void rt_set_task_sleep(struct task *task)
+{
+	struct rt_rq *rq;
+
+	rq = task_rt_rq_lock(task);
+	__rt_dequeue_task(task->cpu, task);
+	raw_spin_unlock(&rq->lock);
+}
+
+/*
+ * pull the highest ready realtime task which is not
+ * running from the overloaded pcpus, if it has higher
+ * prio than the tasks on this pcpu
+ */
+static void rt_pull_tasks(int this_cpu)
+{
+	int cpu;
+	prio_t prio;
+	uint64_t map;
+	struct task *task;
+	struct rt_rq *src, *this = &rt_rqs[this_cpu];
+
+	for_each_cpu(cpu, &rt_overload_mask) {
+		if (cpu == this_cpu)
+			continue;
+
+		src = &rt_rqs[cpu];
+		rt_double_lock(this_cpu, cpu);
+
+		map = src->ready_map;
+		task = __current_tasks[cpu];
+		if (task_is_realtime(task))
+			map &= ~(1UL << task->prio);
+		task = __next_tasks[cpu];
+		if (task_is_realtime(task))
+			map &= ~(1UL << task->prio);
+
+		if (map) {
+			prio = (prio_t)__ffs64(map);
+			if (prio < rt_rq_highest(this)) {
+				task = os_task_table[prio];
+				__rt_dequeue_task(cpu, task);
+				__rt_enqueue_task(this_cpu, task);
+			}
+		}
+
+		rt_double_unlock(this_cpu, cpu);
+	}
+}
+
+/*
+ * this pcpu has realtime task waiting, kick the pcpu
+ * which is running the lowest prio task to pull it
+ */
+static void rt_kick_puller(int this_cpu, prio_t waiting)
+{
+	int cpu, best = -1;
+	prio_t prio, lowest = waiting;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if ((cpu == this_cpu) ||
+				(pcpu_sched_class[cpu] != SCHED_CLASS_GLOBAL))
+			continue;
+
+		prio = pcpu_running_prio(cpu);
+		if (prio > lowest) {
+			lowest = prio;
+			best = cpu;
+		}
+	}
+
+	if (best >= 0)
+		pcpu_resched(best);
+}
+
 void set_task_ready(struct task *task)
 {
 	struct pcpu *pcpu;
 
 	/*
 	 * when call this function need to ensure :
-	 * 1 - kernel sched lock is locked (rt task)
+	 * 1 - the task lock is locked
 	 * 2 - the interrupt is disabled
 	 */
 	if (task_is_idle(task))
 		return;
 
 	if (task_is_realtime(task)) {
-		os_rdy_grp |= task->bity;
-		os_rdy_table[task->by] |= task->bitx;
+		rt_set_task_ready(task);
 	} else {
 		pcpu = get_cpu_var(pcpu);
 		if (pcpu->pcpu_id != task->affinity) {
-			smp_function_call(task->affinity, smp_set_task_ready,
-					(void *)task, 0);
+			queue_remote_wakeup(task);
 			return;
 		}
 
-		list_del(&task->stat_list);
-		list_add(&pcpu->ready_list, &task->stat_list);
-		pcpu->local_rdy_tasks++;
+		if (!task_in_transit(task)) {
+			list_del(&task->stat_list);
+			list_add(&pcpu->ready_list, &task->stat_list);
+			pcpu->local_rdy_tasks++;
+			task->wakeup_ns = NOW();
+			set_need_resched();
+		}
 	}
 
 	if (task->delay) {
 		del_timer(&task->delay_timer);
 		task->delay = 0;
 	}
-
-	set_need_resched();
 }
 
 void set_task_sleep(struct task *task)
@@ -152,9 +604,7 @@ void set_task_sleep(struct task *task)
 		return;
 
 	if (task_is_realtime(task)) {
-		os_rdy_table[task->by] &= ~task->bitx;
-		if (os_rdy_table[task->by] == 0)
-			os_rdy_grp &= ~task->bity;
+		rt_set_task_sleep(task);
 	} else {
 		pcpu = get_cpu_var(pcpu);
 		if (pcpu->pcpu_id != task->affinity) {
@@ -163,6 +613,9 @@ void set_task_sleep(struct task *task)
 			return;
 		}
 
+		if (task_in_transit(task))
+			return;
+
 		list_del(&task->stat_list);
 		list_add(&pcpu->sleep_list, &task->stat_list);
 		pcpu->local_rdy_tasks--;
@@ -193,139 +646,83 @@ struct task *get_highest_task(uint8_t group, prio_t *ready)
 	return os_task_table[(y << 3) + x];
 }
 
-static int __used has_high_prio(prio_t prio, prio_t *array, int *map)
+static void inline task_sched_return(struct task *task)
 {
-	int i;
-
-	for (i = 0; i < NR_CPUS; i++) {
-		if (map[i] == 1)
-			continue;
-
-		if (prio == array[i])
-			return 1;
-	}
+#ifdef CONFIG_VIRT
+	gp_regs *reg;
 
-	return 0;
+	reg = (gp_regs *)task->stack_base;
+	if (task_is_vcpu(task) && taken_from_guest(reg))
+		enter_to_guest((struct vcpu *)task->pdata, NULL);
+#endif
 }
 
-static int __used has_current_prio(prio_t prio, prio_t *array, int *map)
+#ifdef CONFIG_SCHED_NOHZ
+/*
+ * the sched tick is only needed when there are other
+ * percpu tasks ready on the pcpu, or the cap of the
+ * task need to be checked
+ */
+static inline int sched_tick_needed(struct pcpu *pcpu, struct task *task)
 {
-	int i;
+	if (pcpu_has_other_ready(pcpu) || task_migrating(task))
+		return 1;
 
-	for (i = 0; i < NR_CPUS; i++) {
-		if ((prio == array[i]) && (map[i] == 0))
-			return (i + 1);
-	}
-
-	return 0;
+	return ((pcpu_sched_class[pcpu->pcpu_id] == SCHED_CLASS_FAIR) &&
+			(task->cap != 0));
 }
 
-static void sched_new(struct pcpu *pcpu)
+/*
+ * a task is waked up on the pcpu whose tick is stopped,
+ * start a new slice for the running task
+ */
+static void sched_tick_restart(struct pcpu *pcpu, struct task *task)
 {
-	/*
-	 * this function need always called with
-	 * interrupt disabled
-	 */
-	uint8_t x, y, p;
-
-#ifndef CONFIG_OS_REALTIME_CORE0
-	int i, j = 0, k;
-	prio_t rdy_grp;
-	prio_t ncpu_highest[NR_CPUS];
-	int high_map[NR_CPUS];
-	int current_map[NR_CPUS];
-	uint64_t __rdy_table = __os_rdy_table;
-	uint8_t *rdy_table;
-
-	/*
-	 * first check the rt task in the global task
-	 * table, if there is no any realtime task ready
-	 * just exist
-	 */
-	memset(os_highest_rdy, OS_PRIO_PCPU, sizeof(os_highest_rdy));
-	if (__rdy_table == 0)
+	if (!pcpu->tick_stopped || !task_is_percpu(task) ||
+			!sched_tick_needed(pcpu, task))
 		return;
 
-	rdy_grp = os_rdy_grp;
-	rdy_table = (uint8_t *)&__rdy_table;
-	memset(ncpu_highest, OS_PRIO_IDLE + 1, sizeof(ncpu_highest));
-	memset(high_map, 0, sizeof(high_map));
-	memset(current_map, 0, sizeof(current_map));
-
-	for (i = 0; i < NR_CPUS; i++) {
-		if (pcpu_sched_class[i] == SCHED_CLASS_LOCAL) {
-			current_map[i] = 1;
-			high_map[i] = 1;
-			continue;
-		}
-
-		y = ffs_table[rdy_grp];
-		x = ffs_table[rdy_table[y]];
-		p = (y << 3) + x;
-		ncpu_highest[i] = p;
-
-		/* clear the task ready bit */
-		if ((rdy_table[y] &= ~(1 << x)) == 0)
-			rdy_grp &= ~(1 << y);
-
-		if (__rdy_table == 0)
-			break;
-	}
+	pcpu->tick_stopped = 0;
+	task->start_ns = NOW();
+	sched_tick_enable(MILLISECS(task->run_time));
+}
+#else
+static inline int sched_tick_needed(struct pcpu *pcpu, struct task *task)
+{
+	return 1;
+}
 
-	for (i = 0; i < NR_CPUS; i++) {
-		k = has_current_prio(os_prio_cur[i], ncpu_highest, high_map);
-		if (k > 0) {
-			os_highest_rdy[i] = os_prio_cur[i];
-			high_map[k - 1] = 1;
-			current_map[i] = 1;
-		} else {
-			for (j = 0; j < NR_CPUS; j++) {
-				if (high_map[j])
-					continue;
+static inline void sched_tick_restart(struct pcpu *pcpu, struct task *task)
+{
 
-				if (has_high_prio(ncpu_highest[j],
-						os_prio_cur, current_map))
-					continue;
+}
+#endif
 
-				os_highest_rdy[i] = ncpu_highest[j];
-				high_map[j] = 1;
-				break;
-			}
+static void sched_tick_start(struct pcpu *pcpu, struct task *next)
+{
+	if (!task_is_percpu(next) || !sched_tick_needed(pcpu, next)) {
+		if (!pcpu->tick_stopped) {
+			pcpu->tick_stopped = 1;
+			pcpu->nr_tick_stops++;
 		}
+		sched_tick_disable();
+	} else {
+		pcpu->tick_stopped = 0;
+		sched_tick_enable(MILLISECS(next->run_time));
 	}
-
-	for (i = 0; i < NR_CPUS; i++) {
-		if (os_highest_rdy[i] > OS_PRIO_PCPU)
-			os_highest_rdy[i] = OS_PRIO_PCPU;
-	}
-
-	dsb();
-#else
-	/*
-	 * only update the highest realtime task to
-	 * the core0
-	 */
-	os_highest_rdy[0] = OS_PRIO_PCPU;
-	if (__os_rdy_table == 0)
-		return;
-
-	y = ffs_table[os_rdy_grp];
-	x = ffs_table[os_rdy_table[y]];
-	p = (y << 3) + x;
-	os_highest_rdy[0] = p;
-	dsb();
-#endif
 }
 
-static void inline task_sched_return(struct task *task)
+static inline void task_wakeup_stat(struct pcpu *pcpu, struct task *task)
 {
-#ifdef CONFIG_VIRT
-	gp_regs *reg;
+	unsigned long lat;
 
-	reg = (gp_regs *)task->stack_base;
-	if (task_is_vcpu(task) && taken_from_guest(reg))
-		enter_to_guest((struct vcpu *)task->pdata, NULL);
-#endif
+	if (task->wakeup_ns == 0)
+		return;
+
+	lat = task->start_ns - task->wakeup_ns;
+	if (lat > pcpu->max_wakeup_lat)
+		pcpu->max_wakeup_lat = lat;
+	task->wakeup_ns = 0;
 }
 
 static void inline no_task_sched_return(struct task *task)
@@ -338,33 +735,53 @@ static void inline no_task_sched_return(struct task *task)
 	if ((task_info(task)->flags & __TIF_NEED_RESCHED) &&
 			task_is_percpu(task) && (task->start_ns == 0)) {
 		task->start_ns = NOW();
-		sched_tick_enable(MILLISECS(task->run_time));
+		sched_tick_start(get_cpu_var(pcpu), task);
+	} else {
+		sched_tick_restart(get_cpu_var(pcpu), task);
 	}
 
 	task_sched_return(task);
 }
 
+/*
+ * the first ready percpu task on the pcpu, the task
+ * which is going to migrate to other pcpu is skipped
+ */
+static inline struct task *pcpu_first_ready(struct pcpu *pcpu)
+{
+	struct task *task, *next = NULL;
+	unsigned long now = NOW();
+
+	list_for_each_entry(task, &pcpu->ready_list, stat_list) {
+		if (task_migrating(task))
+			continue;
+
+		/* the vcpu whose gang is running goes first */
+		if (task_gang_active(task, now))
+			return task;
+
+		if (!next)
+			next = task;
+	}
+
+	return next ? next : pcpu->idle_task;
+}
+
 static inline struct task *get_next_global_run_task(struct pcpu *pcpu)
 {
-	prio_t prio = os_highest_rdy[pcpu->pcpu_id];
+	prio_t prio = rt_rq_highest(&rt_rqs[pcpu->pcpu_id]);
+
+	os_highest_rdy[pcpu->pcpu_id] = prio;
 
 	if (prio <= OS_LOWEST_PRIO)
 		return os_task_table[prio];
 
-	if (!is_list_empty(&pcpu->ready_list))
-		return list_first_entry(&pcpu->ready_list,
-				struct task, stat_list);
-
-	return pcpu->idle_task;
+	return pcpu_first_ready(pcpu);
 }
 
 static inline struct task *get_next_local_run_task(struct pcpu *pcpu)
 {
-	if (!is_list_empty(&pcpu->ready_list))
-		return list_first_entry(&pcpu->ready_list,
-				struct task, stat_list);
-
-	return pcpu->idle_task;
+	return pcpu_first_ready(pcpu);
 }
 
 static inline void save_task_context(struct task *task)
@@ -403,6 +820,7 @@ static void global_switch_out(struct pcpu *pcpu,
 		struct task *cur, struct task *next)
 {
 	int cpuid = pcpu->pcpu_id;
+	uint64_t map;
 	prio_t prio;
 
 	/* set the current prio to the highest ready */
@@ -414,8 +832,15 @@ static void global_switch_out(struct pcpu *pcpu,
 	os_prio_cur[cpuid] = prio;
 	wmb();
 
-	/* release the kernel lock now */
-	kernel_unlock();
+	/* the context of cur is saved, release the run queue */
+	raw_spin_unlock(&rt_rqs[cpuid].lock);
+
+	/* other realtime task is waiting on this pcpu */
+	map = rt_rqs[cpuid].ready_map;
+	if (task_is_realtime(next))
+		map &= ~(1UL << next->prio);
+	if (map)
+		rt_kick_puller(cpuid, (prio_t)__ffs64(map));
 }
 
 static void local_switch_out(struct pcpu *pcpu,
@@ -428,12 +853,71 @@ static void global_switch_to(struct pcpu *pcpu,
 		struct task *cur, struct task *next)
 {
 
-}
+}
+
+static void local_switch_to(struct pcpu *pcpu,
+		struct task *cur, struct task *next)
+{
+
+}
+
+/*
+ * move the percpu task from this pcpu to the new list
+ * of its new pcpu, the context of the task has been
+ * saved, including the vgic lrs, so it can run on the
+ * new pcpu once it is picked up there. the vruntime of
+ * the task is kept relative to the min_vruntime
+ */
+static void migrate_task_out(struct pcpu *pcpu, struct task *task)
+{
+	int cpu = task->migrate_to;
+	struct pcpu *dst = get_per_cpu(pcpu, cpu);
+
+	list_del(&task->stat_list);
+	if (task_is_ready(task))
+		pcpu->local_rdy_tasks--;
+
+	raw_spin_lock(&pcpu->lock);
+	list_del(&task->list);
+	pcpu->nr_pcpu_task--;
+	raw_spin_unlock(&pcpu->lock);
+
+	task->vruntime -= fair_rqs[pcpu->pcpu_id].min_vruntime;
+	task->exec_start = 0;
+	task->start_ns = 0;
+	task->run_time = CONFIG_TASK_RUN_TIME;
+
+	raw_spin_lock(&dst->lock);
+	list_add_tail(&dst->task_list, &task->list);
+	list_add_tail(&dst->new_list, &task->stat_list);
+	dst->nr_pcpu_task++;
+	task->affinity = cpu;
+	wmb();
+	raw_spin_unlock(&dst->lock);
+
+	pcpu_resched(cpu);
+}
+
+/*
+ * the migrated task arrives this pcpu, the timers of
+ * it need to expire on this pcpu
+ */
+static void migrate_task_in(struct pcpu *pcpu, struct task *task)
+{
+	task->vruntime += fair_rqs[pcpu->pcpu_id].min_vruntime;
+
+	if (task->stat == TASK_STAT_RDY) {
+		list_add_tail(&pcpu->ready_list, &task->stat_list);
+		pcpu->local_rdy_tasks++;
+	} else {
+		list_add_tail(&pcpu->sleep_list, &task->stat_list);
+	}
 
-static void local_switch_to(struct pcpu *pcpu,
-		struct task *cur, struct task *next)
-{
+	task->migrate_to = PCPU_AFF_NONE;
+	wmb();
 
+	migrate_timer(&task->delay_timer);
+	migrate_task_vmodule_state(task);
 }
 
 void switch_to_task(struct task *cur, struct task *next)
@@ -464,16 +948,21 @@ void switch_to_task(struct task *cur, struct task *next)
 	do_hooks((void *)cur, NULL, OS_HOOK_TASK_SWITCH_OUT);
 	pcpu->switch_out(pcpu, cur, next);
 
+	/* cur is requested to move to other pcpu */
+	if (task_migrating(cur) && (cur->affinity == pcpu->pcpu_id))
+		migrate_task_out(pcpu, cur);
+
 	/*
 	 * if the next running task prio is OS_PRIO_PCPU, it
 	 * need to enable the sched timer for fifo task sched
-	 * otherwise disable it.
+	 * otherwise disable it. the tick is also not needed
+	 * when the next task is the only one can run.
 	 */
 	next->start_ns = NOW();
 	if (task_is_percpu(next))
-		sched_tick_enable(MILLISECS(next->run_time));
-	else
-		sched_tick_disable();
+		gang_switch_to(next, next->start_ns);
+	sched_tick_start(pcpu, next);
+	task_wakeup_stat(pcpu, next);
 
 	restore_task_context(next);
 
@@ -495,6 +984,7 @@ unsigned long sched_tick_handler(unsigned long data)
 
 	task = get_current_task();
 	delta = now - task->start_ns;
+	pcpu->nr_ticks++;
 
 	if (task->prio != OS_PRIO_PCPU) {
 		pr_warn("wrong task type on tick handler %d\n", task->pid);
@@ -530,26 +1020,19 @@ unsigned long sched_tick_handler(unsigned long data)
 	return 0;
 }
 
+/*
+ * global sched only touch the realtime run queue of this
+ * pcpu, and the run queues of the overloaded pcpus when
+ * there are realtime tasks waiting on them
+ */
 void global_sched(struct pcpu *pcpu, struct task *cur)
 {
-	int i;
 	struct task *next;
+	struct rt_rq *rq = &rt_rqs[pcpu->pcpu_id];
 
-	kernel_lock();
-
-	sched_new(pcpu);
-
-	/*
-	 * if there other cpu need to change the task running
-	 * on the pcpu, then send the ipi to the related cpu
-	 */
-	for (i = 0; i < NR_CPUS; i++) {
-		if ((os_prio_cur[i] != os_highest_rdy[i])) {
-			if (i != pcpu->pcpu_id)
-				pcpu_resched(i);
-		}
-	}
+	rt_pull_tasks(pcpu->pcpu_id);
 
+	raw_spin_lock(&rq->lock);
 	next = get_next_global_run_task(pcpu);
 	mb();
 
@@ -557,7 +1040,7 @@ void global_sched(struct pcpu *pcpu, struct task *cur)
 		set_next_task(next, pcpu->pcpu_id);
 		arch_switch_task_sw();
 	} else
-		kernel_unlock();
+		raw_spin_unlock(&rq->lock);
 }
 
 /*
@@ -596,6 +1079,9 @@ void sched(void)
 	clear_need_resched();
 	pcpu = get_cpu_var(pcpu);
 	pcpu->sched(pcpu, cur);
+
+	/* the task may be back on other pcpu */
+	sched_tick_restart(get_cpu_var(pcpu), cur);
 	local_irq_restore(flags);
 }
 
@@ -614,7 +1100,7 @@ void sched_task(struct task *task)
 	s_cpu = smp_processor_id();
 
 	if (task_is_realtime(task))
-		t_cpu = task_info(task)->cpu;
+		t_cpu = task->cpu;
 	else
 		t_cpu = task->affinity;
 
@@ -656,29 +1142,12 @@ static void local_irq_handler(struct pcpu *pcpu, struct task *task)
 
 static void global_irq_handler(struct pcpu *pcpu, struct task *task)
 {
-	int i;
 	struct task *next = task;
 	int cpuid = pcpu->pcpu_id;
+	struct rt_rq *rq = &rt_rqs[cpuid];
 
-	kernel_lock();
-
-#if 0
-	/*
-	 * if the highest prio is update by other cpu, then
-	 * sched out directly
-	 */
-	if ((os_prio_cur[cpuid] != os_highest_rdy[cpuid]))
-		goto out;
-#endif
-
-	sched_new(pcpu);
-
-	for (i = 0; i < NR_CPUS; i++) {
-		if (os_prio_cur[i] != os_highest_rdy[i]) {
-			if (i != cpuid)
-				pcpu_resched(i);
-		}
-	}
+	rt_pull_tasks(cpuid);
+	raw_spin_lock(&rq->lock);
 
 	/* 
 	 * if need sched or the current task is idle, then
@@ -695,16 +1164,427 @@ static void global_irq_handler(struct pcpu *pcpu, struct task *task)
 		return;
 	}
 
-	kernel_unlock();
+	raw_spin_unlock(&rq->lock);
 	no_task_sched_return(next);
 }
 
+/*
+ * weight 0 means the default weight, and a cap which is
+ * not less than one pcpu means no cap
+ */
+void sched_clamp_param(uint32_t *weight, uint32_t *cap)
+{
+	if (*weight == 0)
+		*weight = SCHED_WEIGHT_DEFAULT;
+	else if (*weight > SCHED_WEIGHT_MAX)
+		*weight = SCHED_WEIGHT_MAX;
+
+	if (*cap >= SCHED_CAP_MAX)
+		*cap = 0;
+}
+
+void sched_set_task_weight(struct task *task, uint32_t weight, uint32_t cap)
+{
+	sched_clamp_param(&weight, &cap);
+
+	task->weight = weight;
+	task->cap = cap;
+}
+
+static void fair_update_curr(struct task *task)
+{
+	unsigned long now = NOW();
+	unsigned long delta;
+
+	if (!task_is_percpu(task))
+		return;
+
+	if (task->exec_start) {
+		delta = now - task->exec_start;
+		task->vruntime += (uint64_t)delta *
+				SCHED_WEIGHT_DEFAULT / task->weight;
+		task->cap_used += delta;
+	}
+
+	task->exec_start = now;
+}
+
+static inline unsigned long fair_cap_budget(struct task *task)
+{
+	return (SCHED_CAP_PERIOD / 100) * task->cap;
+}
+
+static inline int fair_task_throttled(struct task *task)
+{
+	if (task->cap == 0)
+		return 0;
+
+	return (task->cap_used >= fair_cap_budget(task));
+}
+
+static void fair_period_timer_handler(unsigned long data)
+{
+	set_need_resched();
+}
+
+static void fair_check_period(struct pcpu *pcpu,
+		struct fair_rq *rq, unsigned long now)
+{
+	struct task *task;
+
+	if (now - rq->period_start < SCHED_CAP_PERIOD)
+		return;
+
+	rq->period_start = now;
+	raw_spin_lock(&pcpu->lock);
+	list_for_each_entry(task, &pcpu->task_list, list)
+		task->cap_used = 0;
+	raw_spin_unlock(&pcpu->lock);
+}
+
+static struct task *fair_pick_next(struct pcpu *pcpu, struct task *cur)
+{
+	struct fair_rq *rq = &fair_rqs[pcpu->pcpu_id];
+	uint64_t latency = MILLISECS(CONFIG_SCHED_LATENCY);
+	struct task *task, *next = NULL, *gang = NULL;
+	int nr = 0, throttled = 0;
+	unsigned long slice, left, now = NOW();
+
+	fair_update_curr(cur);
+	fair_check_period(pcpu, rq, now);
+
+	list_for_each_entry(task, &pcpu->ready_list, stat_list) {
+		if (task_migrating(task))
+			continue;
+
+		if (fair_task_throttled(task)) {
+			throttled = 1;
+			continue;
+		}
+
+		/*
+		 * the task which has slept for a long time can
+		 * only get one sched latency of bonus
+		 */
+		if (task->vruntime + latency < rq->min_vruntime)
+			task->vruntime = rq->min_vruntime - latency;
+
+		if (!gang && task_gang_active(task, now))
+			gang = task;
+
+		if (!next || (task->vruntime < next->vruntime))
+			next = task;
+		nr++;
+	}
+
+	if (throttled)
+		mod_timer(&rq->period_timer,
+				rq->period_start + SCHED_CAP_PERIOD);
+
+	if (!next)
+		return pcpu->idle_task;
+
+	/* the vcpu whose gang is running can not wait */
+	if (gang)
+		next = gang;
+
+	/*
+	 * do not preempt the current task before it has run
+	 * the min granularity, unless its slice is used up
+	 */
+	if (!gang && (next != cur) && task_is_percpu(cur) && task_is_ready(cur) &&
+			cur->start_ns && !fair_task_throttled(cur) &&
+			!task_migrating(cur) &&
+			(cur->vruntime - next->vruntime <
+			 MILLISECS(CONFIG_SCHED_MIN_GRANULARITY)))
+		next = cur;
+
+	if (next->vruntime > rq->min_vruntime)
+		rq->min_vruntime = next->vruntime;
+
+	slice = CONFIG_SCHED_LATENCY / nr;
+	if (slice < CONFIG_SCHED_MIN_GRANULARITY)
+		slice = CONFIG_SCHED_MIN_GRANULARITY;
+	if (slice > CONFIG_TASK_RUN_TIME)
+		slice = CONFIG_TASK_RUN_TIME;
+
+	/*
+	 * the slice of a capped task can not be longer than
+	 * the budget left in this period, otherwise it will
+	 * run over its cap by up to a whole slice
+	 */
+	if (next->cap) {
+		left = (fair_cap_budget(next) - next->cap_used) / MILLISECS(1);
+		if (left == 0)
+			left = 1;
+		if (slice > left)
+			slice = left;
+	}
+	rq->slice = slice;
+
+	return next;
+}
+
+void fair_sched(struct pcpu *pcpu, struct task *cur)
+{
+	struct task *next;
+
+	next = fair_pick_next(pcpu, cur);
+	mb();
+
+	if (next == cur)
+		return;
+
+	set_next_task(next, pcpu->pcpu_id);
+	arch_switch_task_sw();
+}
+
+static void fair_irq_handler(struct pcpu *pcpu, struct task *task)
+{
+	struct task *next;
+
+	next = fair_pick_next(pcpu, task);
+	if (next == task) {
+		/* the slice is used up, start a new one */
+		if (task->start_ns == 0)
+			task->run_time = fair_rqs[pcpu->pcpu_id].slice;
+		no_task_sched_return(task);
+		return;
+	}
+
+	set_next_task(next, pcpu->pcpu_id);
+	switch_to_task(task, next);
+}
+
+static void fair_switch_out(struct pcpu *pcpu,
+		struct task *cur, struct task *next)
+{
+	fair_update_curr(cur);
+
+	next->exec_start = NOW();
+	next->run_time = fair_rqs[pcpu->pcpu_id].slice;
+}
+
+static void fair_switch_to(struct pcpu *pcpu,
+		struct task *cur, struct task *next)
+{
+
+}
+
+/*
+ * put the current percpu task to the tail of the ready
+ * list and let other task on this pcpu run first
+ */
+void sched_yield(void)
+{
+	unsigned long flags;
+	struct pcpu *pcpu;
+	struct task *cur = get_current_task();
+
+	local_irq_save(flags);
+	pcpu = get_cpu_var(pcpu);
+	if (task_is_percpu(cur) && task_is_ready(cur)) {
+		list_del(&cur->stat_list);
+		list_add_tail(&pcpu->ready_list, &cur->stat_list);
+
+		if (pcpu_sched_class[pcpu->pcpu_id] == SCHED_CLASS_FAIR) {
+			fair_update_curr(cur);
+			cur->vruntime += MILLISECS(CONFIG_SCHED_MIN_GRANULARITY);
+		}
+	}
+	local_irq_restore(flags);
+
+	sched();
+}
+
+static void smp_sched_yield_to(void *data)
+{
+	struct task *task = data;
+	struct pcpu *pcpu = get_cpu_var(pcpu);
+	struct fair_rq *rq = &fair_rqs[pcpu->pcpu_id];
+
+	/*
+	 * the task has already run or gone to sleep, or
+	 * it is moving to other pcpu
+	 */
+	if ((current == task) || (task->stat != TASK_STAT_RDY) ||
+			(task->affinity != pcpu->pcpu_id) ||
+			task_migrating(task))
+		return;
+
+	list_del(&task->stat_list);
+	list_add(&pcpu->ready_list, &task->stat_list);
+
+	if ((pcpu_sched_class[pcpu->pcpu_id] == SCHED_CLASS_FAIR) &&
+			(task->vruntime > rq->min_vruntime))
+		task->vruntime = rq->min_vruntime;
+
+	set_need_resched();
+}
+
+/*
+ * let the percpu task which is ready but preempted run
+ * as soon as possible on its pcpu
+ */
+int sched_yield_to(struct task *task)
+{
+	if (!task_is_percpu(task) || (task->stat != TASK_STAT_RDY))
+		return -EINVAL;
+
+	return smp_function_call(task->affinity,
+			smp_sched_yield_to, task, 0);
+}
+
+static void smp_migrate_task(void *data)
+{
+	struct task *task = data;
+	struct pcpu *pcpu = get_cpu_var(pcpu);
+
+	/* the task has been moved out when it switched out */
+	if (!task_migrating(task) || (task->affinity != pcpu->pcpu_id))
+		return;
+
+	/*
+	 * the task is running on this pcpu, it will be moved
+	 * out after its context is saved
+	 */
+	if (task_on_cpu(task, pcpu->pcpu_id)) {
+		set_need_resched();
+		return;
+	}
+
+	migrate_task_out(pcpu, task);
+}
+
+/*
+ * move the percpu task to another pcpu, the task is
+ * moved out by its current pcpu when it is not running
+ * there, and then picked up by the new pcpu. return
+ * -EBUSY if the task is already migrating
+ */
+int sched_migrate_task(struct task *task, int cpu)
+{
+	unsigned long flags;
+	int src;
+
+	if (!task_is_percpu(task) || task_is_idle(task))
+		return -EINVAL;
+
+	if ((cpu < 0) || (cpu >= NR_CPUS) || !test_bit(cpu, cpu_online.bits))
+		return -EINVAL;
+
+	task_lock_irqsave(task, flags);
+	if (task_migrating(task)) {
+		task_unlock_irqrestore(task, flags);
+		return -EBUSY;
+	}
+
+	src = task->affinity;
+	if (src == cpu) {
+		task_unlock_irqrestore(task, flags);
+		return 0;
+	}
+
+	task->migrate_to = cpu;
+	wmb();
+	task_unlock_irqrestore(task, flags);
+
+	return smp_function_call(src, smp_migrate_task, task, 0);
+}
+
+#ifdef CONFIG_VIRT
+/*
+ * sample the number of the runnable percpu tasks on the
+ * pcpu and update the load average of it, the new sample
+ * has a quarter of the weight
+ */
+static unsigned long pcpu_update_load(struct pcpu *pcpu)
+{
+	unsigned long flags, nr = 0;
+	struct task *task;
+
+	spin_lock_irqsave(&pcpu->lock, flags);
+	list_for_each_entry(task, &pcpu->task_list, list) {
+		if (task_is_ready(task) && !task_migrating(task))
+			nr++;
+	}
+	spin_unlock_irqrestore(&pcpu->lock, flags);
+
+	pcpu->load_avg = (pcpu->load_avg * 3 +
+			(nr << SCHED_LOAD_SHIFT)) >> 2;
+
+	return pcpu->load_avg;
+}
+
+/*
+ * only the vcpu which is waiting to run on the busiest
+ * pcpu is moved, the running one is cache hot
+ */
+static struct task *balance_pick_task(struct pcpu *pcpu, int cpu)
+{
+	struct task *task, *target = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pcpu->lock, flags);
+	list_for_each_entry(task, &pcpu->task_list, list) {
+		if (!task_is_vcpu(task) || (task->stat != TASK_STAT_RDY) ||
+				task_migrating(task))
+			continue;
+
+		if (vcpu_can_migrate(task_to_vcpu(task), cpu)) {
+			target = task;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&pcpu->lock, flags);
+
+	return target;
+}
+
+static void sched_balance_handler(unsigned long data)
+{
+	int cpu, busiest = -1, idlest = -1;
+	unsigned long load, max = 0, min = 0;
+	struct task *task;
+
+	for_each_online_cpu(cpu) {
+		load = pcpu_update_load(get_per_cpu(pcpu, cpu));
+		if ((busiest < 0) || (load > max)) {
+			max = load;
+			busiest = cpu;
+		}
+
+		if ((idlest < 0) || (load < min)) {
+			min = load;
+			idlest = cpu;
+		}
+	}
+
+	if ((busiest != idlest) && (max - min > SCHED_BALANCE_THRESHOLD)) {
+		task = balance_pick_task(get_per_cpu(pcpu, busiest), idlest);
+		if (task && !vcpu_migrate(task_to_vcpu(task), idlest)) {
+			pr_debug("balance %s pcpu-%d -> pcpu-%d\n",
+					task->name, busiest, idlest);
+
+			/* count the moved vcpu now to avoid moving it back */
+			get_per_cpu(pcpu, busiest)->load_avg -= SCHED_LOAD_SCALE;
+			get_per_cpu(pcpu, idlest)->load_avg += SCHED_LOAD_SCALE;
+		}
+	}
+
+	mod_timer(&balance_timer,
+			NOW() + MILLISECS(CONFIG_SCHED_BALANCE_PERIOD));
+}
+#endif
+
 void irq_return_handler(struct task *task)
 {
 	int p, n;
 	struct task_info *ti;
 	struct pcpu *pcpu = get_cpu_var(pcpu);
 
+	drain_remote_wakeups(pcpu);
+
 	ti = (struct task_info *)task->stack_origin;
 	p = ti->preempt_count;
 	n = !(ti->flags & __TIF_NEED_RESCHED);
@@ -756,6 +1636,13 @@ static void __used *of_setup_pcpu(struct device_node *node, void *data)
 		pcpu->switch_to = local_switch_to;
 		pcpu->irq_handler = local_irq_handler;
 		pcpu_sched_class[cpuid] = SCHED_CLASS_LOCAL;
+	} else if (!strcmp(class, "fair")) {
+		pcpu = get_per_cpu(pcpu, cpuid);
+		pcpu->sched = fair_sched;
+		pcpu->switch_out = fair_switch_out;
+		pcpu->switch_to = fair_switch_to;
+		pcpu->irq_handler = fair_irq_handler;
+		pcpu_sched_class[cpuid] = SCHED_CLASS_FAIR;
 	} else {
 		pr_warn("unsupport sched class\n");
 	}
@@ -817,7 +1704,20 @@ void pcpus_init(void)
 
 int sched_init(void)
 {
-	os_rdy_table = (uint8_t *)&__os_rdy_table;
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		spin_lock_init(&rt_rqs[i].lock);
+
+		init_timer_on_cpu(&fair_rqs[i].period_timer, i);
+		fair_rqs[i].period_timer.function = fair_period_timer_handler;
+		fair_rqs[i].slice = CONFIG_TASK_RUN_TIME;
+	}
+
+#ifdef CONFIG_VIRT
+	init_timer_on_cpu(&balance_timer, 0);
+	balance_timer.function = sched_balance_handler;
+#endif
 
 	return 0;
 }
@@ -834,7 +1734,9 @@ int resched_handler(uint32_t irq, void *data)
 	raw_spin_lock(&pcpu->lock);
 	list_for_each_entry_safe(task, n, &pcpu->new_list, stat_list) {
 		list_del(&task->stat_list);
-		if (task->stat == TASK_STAT_RDY) {
+		if (task_migrating(task)) {
+			migrate_task_in(pcpu, task);
+		} else if (task->stat == TASK_STAT_RDY) {
 			list_add_tail(&pcpu->ready_list, &task->stat_list);
 		} else {
 			list_add_tail(&pcpu->sleep_list, &task->stat_list);
@@ -853,6 +1755,13 @@ int local_sched_init(void)
 
 	pcpu->state = PCPU_STATE_RUNNING;
 
+#ifdef CONFIG_VIRT
+	/* the vcpus are balanced by pcpu0 periodically */
+	if ((pcpu->pcpu_id == 0) && CONFIG_SCHED_BALANCE_PERIOD)
+		mod_timer(&balance_timer,
+			NOW() + MILLISECS(CONFIG_SCHED_BALANCE_PERIOD));
+#endif
+
 	return request_irq(CONFIG_MINOS_RESCHED_IRQ, resched_handler,
 			0, "resched handler", NULL);
 }
@@ -20,7 +20,12 @@
 #include <minos/platform.h>
 #include <minos/irq.h>
 
-#define SMP_CALL_LOCKED		(1 << 0)
+#ifndef CONFIG_SMP_CALL_QUEUE_SIZE
+#define CONFIG_SMP_CALL_QUEUE_SIZE	16
+#endif
+
+#define SMP_CALL_QUEUE_SIZE	CONFIG_SMP_CALL_QUEUE_SIZE
+#define SMP_CALL_QUEUE_MASK	(SMP_CALL_QUEUE_SIZE - 1)
 
 extern unsigned char __smp_affinity_id;
 uint64_t *smp_affinity_id;
@@ -31,56 +36,140 @@ static int cpus_all_up;
 
 struct smp_call {
 	smp_function fn;
-	unsigned long flags;
 	void *data;
+	unsigned long ts;
+};
+
+/*
+ * each pcpu has one call queue for each sender, the
+ * sender only updates the tail and the target only
+ * updates the head after the function is called, so
+ * the queue does not need lock, and the calls from
+ * one sender are called in order
+ */
+struct smp_call_queue {
+	volatile unsigned long head;
+	volatile unsigned long tail;
+	struct smp_call calls[SMP_CALL_QUEUE_SIZE];
 };
 
 struct smp_call_data {
-	struct smp_call smp_calls[NR_CPUS];
+	/*
+	 * kick is not zero means the sgi has been sent
+	 * and the queues are not drained yet, other
+	 * senders do not need to send the sgi again
+	 */
+	atomic_t kick;
+	int draining;
+	unsigned long nr_calls;
+	unsigned long nr_irqs;
+	unsigned long max_latency;
+	struct smp_call_queue queues[NR_CPUS];
 };
 
 static DEFINE_PER_CPU(struct smp_call_data, smp_call_data);
 
-static void inline smp_call_wait(struct smp_call *call)
+int is_cpus_all_up(void)
 {
-	/* need wait for last call finished */
-	while (call->flags & SMP_CALL_LOCKED)
-		cpu_relax();
+	return cpus_all_up;
 }
 
-static void inline smp_call_lock(struct smp_call *call)
+/*
+ * the head is only updated after the function returns
+ * since the sender waits on it, so a function which
+ * sends a call itself must not drain the queues again,
+ * otherwise the call at the head is called twice
+ */
+static void smp_call_drain(struct smp_call_data *cd)
 {
-	if (call->flags & SMP_CALL_LOCKED)
-		pr_warn("smp call is already locked\n");
+	int i;
+	struct smp_call_queue *q;
+	struct smp_call *call;
+	unsigned long lat;
 
-	call->flags |= SMP_CALL_LOCKED;
-	wmb();
+	if (cd->draining)
+		return;
+
+	cd->draining = 1;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		q = &cd->queues[i];
+		while (q->head != q->tail) {
+			rmb();
+			call = &q->calls[q->head & SMP_CALL_QUEUE_MASK];
+
+			lat = NOW() - call->ts;
+			if (lat > cd->max_latency)
+				cd->max_latency = lat;
+			cd->nr_calls++;
+
+			call->fn(call->data);
+			mb();
+			q->head++;
+		}
+	}
+
+	cd->draining = 0;
 }
 
-static void inline smp_call_unlock(struct smp_call *call)
+/*
+ * the irq of the sender need to be disabled, the
+ * return value is the sequence of the call which
+ * can be used to wait the call finished
+ */
+static unsigned long smp_call_enqueue(struct smp_call_queue *q,
+		smp_function fn, void *data)
 {
-	call->flags &= ~SMP_CALL_LOCKED;
+	struct smp_call *call;
+
+	/*
+	 * wait for a free entry if the queue is full, the
+	 * target may also be waiting for the queue of this
+	 * cpu with its irq disabled, so handle the calls
+	 * sent to this cpu while waiting, the sgi for them
+	 * is still pending and will find the queues empty
+	 */
+	while (q->tail - q->head >= SMP_CALL_QUEUE_SIZE) {
+		smp_call_drain(&get_cpu_var(smp_call_data));
+		cpu_relax();
+	}
+
+	call = &q->calls[q->tail & SMP_CALL_QUEUE_MASK];
+	call->fn = fn;
+	call->data = data;
+	call->ts = NOW();
 	wmb();
+
+	q->tail++;
+	mb();
+
+	return q->tail;
 }
 
-int is_cpus_all_up(void)
+static void inline smp_call_wait(struct smp_call_queue *q, unsigned long seq)
 {
-	return cpus_all_up;
+	while ((long)(q->head - seq) < 0)
+		cpu_relax();
+}
+
+static inline int smp_call_need_kick(struct smp_call_data *cd)
+{
+	return (atomic_inc_return_old(&cd->kick) == 0);
 }
 
 int smp_function_call(int cpu, smp_function fn, void *data, int wait)
 {
-	int cpuid;
-	struct smp_call *call;
+	int cpuid, kick;
+	struct smp_call_queue *q;
 	struct smp_call_data *cd;
-	unsigned long flags;
+	unsigned long flags, seq;
+
+	if ((cpu < 0) || (cpu >= NR_CPUS))
+		return -EINVAL;
 
 	preempt_disable();
 	cpuid = smp_processor_id();
 
-	if (cpu >= NR_CPUS)
-		return -EINVAL;
-
 	/* function call itself just call the function */
 	if (cpu == cpuid) {
 		local_irq_save(flags);
@@ -91,40 +180,111 @@ int smp_function_call(int cpu, smp_function fn, void *data, int wait)
 	}
 
 	cd = &get_per_cpu(smp_call_data, cpu);
-	call = &cd->smp_calls[cpuid];
+	q = &cd->queues[cpuid];
 
-	smp_call_wait(call);
-	call->fn = fn;
-	call->data = data;
-	smp_call_lock(call);
+	local_irq_save(flags);
+	seq = smp_call_enqueue(q, fn, data);
+	kick = smp_call_need_kick(cd);
+	local_irq_restore(flags);
 
-	send_sgi(SMP_FUNCTION_CALL_IRQ, cpu);
+	if (kick)
+		send_sgi(SMP_FUNCTION_CALL_IRQ, cpu);
 
 	if (wait)
-		smp_call_wait(call);
+		smp_call_wait(q, seq);
 
 	preempt_enable();
 
 	return 0;
 }
 
-static int smp_function_call_handler(uint32_t irq, void *data)
+/*
+ * call the function on all the cpus in the mask, the
+ * sgi is sent to all the targets by one request, the
+ * function is also called on this cpu if it is in the
+ * mask
+ */
+int smp_function_call_many(cpumask_t *mask, smp_function fn,
+		void *data, int wait)
 {
-	int i;
+	int cpu, cpuid, self = 0, nr_kicks = 0;
+	unsigned long seq[NR_CPUS];
 	struct smp_call_data *cd;
-	struct smp_call *call;
+	unsigned long flags;
+	cpumask_t kicks;
 
-	cd = &get_cpu_var(smp_call_data);
+	cpumask_clearall(&kicks);
 
-	for (i = 0; i < NR_CPUS; i++) {
-		call = &cd->smp_calls[i];
-		if (call->flags & SMP_CALL_LOCKED) {
-			call->fn(call->data);
-			call->fn = NULL;
-			call->data = NULL;
-			smp_call_unlock(call);
+	preempt_disable();
+	cpuid = smp_processor_id();
+
+	local_irq_save(flags);
+	for_each_cpu(cpu, mask) {
+		if (cpu == cpuid) {
+			self = 1;
+			continue;
+		}
+
+		cd = &get_per_cpu(smp_call_data, cpu);
+		seq[cpu] = smp_call_enqueue(&cd->queues[cpuid], fn, data);
+		if (smp_call_need_kick(cd)) {
+			cpumask_set_cpu(cpu, &kicks);
+			nr_kicks++;
 		}
 	}
+	local_irq_restore(flags);
+
+	if (nr_kicks)
+		send_sgi_mask(SMP_FUNCTION_CALL_IRQ, &kicks);
+
+	if (self) {
+		local_irq_save(flags);
+		fn(data);
+		local_irq_restore(flags);
+	}
+
+	if (wait) {
+		for_each_cpu(cpu, mask) {
+			if (cpu == cpuid)
+				continue;
+
+			cd = &get_per_cpu(smp_call_data, cpu);
+			smp_call_wait(&cd->queues[cpuid], seq[cpu]);
+		}
+	}
+
+	preempt_enable();
+
+	return 0;
+}
+
+void smp_call_dump_stat(void)
+{
+	int cpu;
+	struct smp_call_data *cd;
+
+	for_each_online_cpu(cpu) {
+		cd = &get_per_cpu(smp_call_data, cpu);
+		pr_info("smp call cpu%d calls:%lu irqs:%lu max lat:%luns\n",
+				cpu, cd->nr_calls, cd->nr_irqs,
+				cd->max_latency);
+	}
+}
+
+static int smp_function_call_handler(uint32_t irq, void *data)
+{
+	struct smp_call_data *cd;
+
+	cd = &get_cpu_var(smp_call_data);
+	cd->nr_irqs++;
+
+	/*
+	 * clear the kick before drain the queues, the call
+	 * which is queued after this will send a new sgi
+	 */
+	atomic_set(&cd->kick, 0);
+	mb();
+	smp_call_drain(cd);
 
 	return 0;
 }
@@ -181,6 +181,14 @@ int vsprintf(char *buf, const char *fmt, va_list arg)
 		}
 
 		fmt++;
+
+		/*
+		 * long and int are both passed as a long here, so
+		 * just skip the length modifier
+		 */
+		if (*fmt == 'l')
+			fmt++;
+
 		switch (*fmt) {
 			case 'd':
 				flag |= PRINTF_DEC | PRINTF_SIGNED;
@@ -157,9 +157,11 @@ static void task_init(struct task *task, char *name,
 		task->stat = TASK_STAT_RDY;
 	
 	task->affinity = aff;
+	task->migrate_to = PCPU_AFF_NONE;
 	task->flags = opt;
 	task->del_req = 0;
 	task->run_time = CONFIG_TASK_RUN_TIME;
+	task->weight = SCHED_WEIGHT_DEFAULT;
 
 	if (task->prio == OS_PRIO_IDLE)
 		task->flags |= TASK_FLAGS_IDLE;	
@@ -24,76 +24,339 @@
 
 DEFINE_PER_CPU(struct timers, timers);
 
+#define TIMER_SLOT_NONE		(-1)
+#define TIMER_INDEX_NONE	(-1)
+
+static inline unsigned long timer_tick(unsigned long expires)
+{
+	return expires >> TIMER_WHEEL_GRAN_SHIFT;
+}
+
+static inline int timer_pending(const struct timer_list * timer)
+{
+	return ((timer->slot != TIMER_SLOT_NONE) ||
+			(timer->index != TIMER_INDEX_NONE));
+}
+
+static inline void heap_set(struct timers *timers,
+		int i, struct timer_list *timer)
+{
+	timers->heap[i] = timer;
+	timer->index = i;
+}
+
+static void heap_sift_up(struct timers *timers, int i)
+{
+	struct timer_list *timer = timers->heap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (timers->heap[parent]->expires <= timer->expires)
+			break;
+
+		heap_set(timers, i, timers->heap[parent]);
+		i = parent;
+	}
+
+	heap_set(timers, i, timer);
+}
+
+static void heap_sift_down(struct timers *timers, int i)
+{
+	struct timer_list *timer = timers->heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < timers->heap_nr) {
+		if ((child + 1 < timers->heap_nr) &&
+				(timers->heap[child + 1]->expires <
+				 timers->heap[child]->expires))
+			child++;
+
+		if (timer->expires <= timers->heap[child]->expires)
+			break;
+
+		heap_set(timers, i, timers->heap[child]);
+		i = child;
+	}
+
+	heap_set(timers, i, timer);
+}
+
+static int heap_add(struct timers *timers, struct timer_list *timer)
+{
+	if (timers->heap_nr == TIMER_HEAP_SIZE)
+		return -ENOSPC;
+
+	heap_set(timers, timers->heap_nr, timer);
+	heap_sift_up(timers, timers->heap_nr++);
+
+	return 0;
+}
+
+static void heap_del(struct timers *timers, struct timer_list *timer)
+{
+	struct timer_list *last;
+	int i = timer->index;
+
+	timer->index = TIMER_INDEX_NONE;
+	last = timers->heap[--timers->heap_nr];
+	if (last == timer)
+		return;
+
+	heap_set(timers, i, last);
+	if ((i > 0) && (last->expires < timers->heap[(i - 1) / 2]->expires))
+		heap_sift_up(timers, i);
+	else
+		heap_sift_down(timers, i);
+}
+
+/*
+ * a timer on level n will be cascaded when the wheel
+ * clk reach the start of its level n slot, the timer
+ * which is out of the wheel range will be put on the
+ * last slot of the top level and cascaded again later
+ */
+static int wheel_slot(struct timers *timers, unsigned long tick)
+{
+	int level, shift;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		shift = level * TIMER_LVL_BITS;
+		if (((tick >> shift) - (timers->clk >> shift)) < TIMER_LVL_SIZE)
+			goto out;
+	}
+
+	level = TIMER_WHEEL_LEVELS - 1;
+	shift = level * TIMER_LVL_BITS;
+	tick = ((timers->clk >> shift) + TIMER_LVL_MASK) << shift;
+out:
+	return (level * TIMER_LVL_SIZE) + ((tick >> shift) & TIMER_LVL_MASK);
+}
+
+static void enqueue_timer(struct timers *timers, struct timer_list *timer)
+{
+	unsigned long tick = timer_tick(timer->expires);
+	int slot;
+
+	if (tick <= (timers->clk + TIMER_NEAR_TICKS)) {
+		if (!heap_add(timers, timer))
+			return;
+
+		/* the heap is full, put it to the overflow list */
+		slot = TIMER_OVERFLOW_SLOT;
+	} else {
+		slot = wheel_slot(timers, tick);
+		timers->pending[slot / TIMER_LVL_SIZE] |=
+			(1UL << (slot & TIMER_LVL_MASK));
+	}
+
+	list_add_tail(&timers->wheel[slot], &timer->entry);
+	timer->slot = slot;
+}
+
+static void detach_timer(struct timers *timers, struct timer_list *timer)
+{
+	int slot = timer->slot;
+
+	if (timer->index != TIMER_INDEX_NONE)
+		heap_del(timers, timer);
+
+	if (slot != TIMER_SLOT_NONE) {
+		list_del(&timer->entry);
+		timer->slot = TIMER_SLOT_NONE;
+
+		if ((slot < TIMER_WHEEL_SLOTS) &&
+				is_list_empty(&timers->wheel[slot]))
+			timers->pending[slot / TIMER_LVL_SIZE] &=
+				~(1UL << (slot & TIMER_LVL_MASK));
+	}
+
+	atomic_set(&timer->del_request, 0);
+}
+
+/*
+ * return the wheel tick of the next slot which need
+ * to be cascaded, each level only need to find the
+ * first pending slot after the current clk
+ */
+static unsigned long wheel_next_tick(struct timers *timers)
+{
+	unsigned long next = ~0UL, tick, pending;
+	int level, shift, idx;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		pending = timers->pending[level];
+		if (!pending)
+			continue;
+
+		shift = level * TIMER_LVL_BITS;
+		idx = ((timers->clk >> shift) + 1) & TIMER_LVL_MASK;
+		if (idx)
+			pending = (pending >> idx) |
+				(pending << (TIMER_LVL_SIZE - idx));
+
+		tick = ((timers->clk >> shift) + __ffs(pending) + 1) << shift;
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+static void cascade_timers(struct timers *timers, int slot)
+{
+	struct list_head *head = &timers->wheel[slot];
+	struct timer_list *timer;
+
+	timers->pending[slot / TIMER_LVL_SIZE] &=
+			~(1UL << (slot & TIMER_LVL_MASK));
+
+	while (!is_list_empty(head)) {
+		timer = list_first_entry(head, struct timer_list, entry);
+		list_del(&timer->entry);
+		timer->slot = TIMER_SLOT_NONE;
+
+		if (atomic_read(&timer->del_request)) {
+			pr_debug("timer has been deleted\n");
+			atomic_set(&timer->del_request, 0);
+			timer->expires = (unsigned long)~0;
+			continue;
+		}
+
+		enqueue_timer(timers, timer);
+	}
+}
+
+static void forward_timers(struct timers *timers, unsigned long now)
+{
+	unsigned long tick = timer_tick(now);
+	unsigned long next;
+	int level, shift;
+
+	while ((next = wheel_next_tick(timers)) <= tick) {
+		timers->clk = next;
+
+		for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+			shift = level * TIMER_LVL_BITS;
+			if (next & ((1UL << shift) - 1))
+				break;
+
+			if (timers->pending[level] &
+				(1UL << ((next >> shift) & TIMER_LVL_MASK)))
+				cascade_timers(timers, level * TIMER_LVL_SIZE +
+					((next >> shift) & TIMER_LVL_MASK));
+		}
+	}
+
+	if (tick > timers->clk)
+		timers->clk = tick;
+}
+
+static void refill_near_heap(struct timers *timers)
+{
+	struct list_head *head = &timers->wheel[TIMER_OVERFLOW_SLOT];
+	struct timer_list *timer;
+
+	while (!is_list_empty(head) && (timers->heap_nr < TIMER_HEAP_SIZE)) {
+		timer = list_first_entry(head, struct timer_list, entry);
+		list_del(&timer->entry);
+		timer->slot = TIMER_SLOT_NONE;
+		heap_add(timers, timer);
+	}
+}
+
+static struct timer_list *
+next_expired_timer(struct timers *timers, unsigned long now)
+{
+	struct timer_list *timer;
+
+	refill_near_heap(timers);
+
+	if (timers->heap_nr && (timers->heap[0]->expires <= now))
+		return timers->heap[0];
+
+	/* only happened when the near heap is full */
+	list_for_each_entry(timer, &timers->wheel[TIMER_OVERFLOW_SLOT], entry) {
+		if (timer->expires <= now)
+			return timer;
+	}
+
+	return NULL;
+}
+
+static unsigned long timers_next_expires(struct timers *timers)
+{
+	unsigned long expires = ~0UL;
+	unsigned long tick;
+	struct timer_list *timer;
+
+	if (timers->heap_nr)
+		expires = timers->heap[0]->expires;
+
+	list_for_each_entry(timer, &timers->wheel[TIMER_OVERFLOW_SLOT], entry) {
+		if (timer->expires < expires)
+			expires = timer->expires;
+	}
+
+	tick = wheel_next_tick(timers);
+	if ((tick != ~0UL) && ((tick << TIMER_WHEEL_GRAN_SHIFT) < expires))
+		expires = tick << TIMER_WHEEL_GRAN_SHIFT;
+
+	return expires;
+}
+
 static void run_timer_softirq(struct softirq_action *h)
 {
 	struct timer_list *timer;
-	unsigned long expires = ~0, now;
+	unsigned long expires, now;
 	struct timers *timers = &get_cpu_var(timers);
-	struct list_head *entry;
-	struct list_head *next;
 	timer_func_t fn;
 	unsigned long data;
+	int del;
 
 	now = NOW();
 
-	/* 
+	/*
 	 * need to aquire the spinlock in case of other
-	 * cpu process the list, first thing is to check
-	 * whether the timer has been canceled
+	 * cpu process the timers, the timers on the wheel
+	 * slots which reached are cascaded to the lower
+	 * level or to the near heap first
 	 */
 	raw_spin_lock(&timers->lock);
-	entry = &timers->active;
-	next = timers->active.next;
-
-	while ((next != entry) && (next != NULL)) {
-		timer = list_entry(next, struct timer_list, entry);
-		next = next->next;
-
-		/* 
-		 * there may be a issue that when the next entry
-		 * has been delete from the timers list, this will cause
-		 * that not all the timer can be handled, need to be
-		 * fix later, currently only panic here for debug purpose
-		 *
-		 * here use a member to indicate whether this timer is
-		 * requested to be deleted
+	forward_timers(timers, now);
+
+	while ((timer = next_expired_timer(timers,
+				now + DEFAULT_TIMER_MARGIN))) {
+		/*
+		 * here use a member to indicate whether this timer
+		 * is requested to be deleted by other cpu
 		 */
-		if (atomic_read(&timer->del_request)) {
+		del = atomic_read(&timer->del_request);
+		detach_timer(timers, timer);
+		if (del) {
 			pr_debug("timer has been deleted\n");
-			list_del(&timer->entry);
-			timer->entry.next = NULL;
 			timer->expires = (unsigned long)~0;
 			continue;
 		}
 
-		if (timer->expires <= (now + DEFAULT_TIMER_MARGIN)) {	
-			/* 
-			 * need to release the spin lock to avoid
-			 * dead lock because on the timer handler
-			 * function the task may aquire other spinlocks
-			 */
-			fn = timer->function;
-			data = timer->data;
-
-			list_del(&timer->entry);
-			timer->entry.next = NULL;
-			timers->running_timer = timer;
-			raw_spin_unlock(&timers->lock);
-
-			fn(data);
+		/*
+		 * need to release the spin lock to avoid
+		 * dead lock because on the timer handler
+		 * function the task may aquire other spinlocks
+		 */
+		fn = timer->function;
+		data = timer->data;
+		timers->running_timer = timer;
+		raw_spin_unlock(&timers->lock);
 
-			raw_spin_lock(&timers->lock);
-		}
+		fn(data);
 
-		/* 
-		 * need to check whether the timer has been
-		 * add to timers list again
-		 */
-		if ((timer->entry.next != NULL) &&
-				(expires > timer->expires))
-			expires = timer->expires;
+		raw_spin_lock(&timers->lock);
 	}
 
+	timers->running_timer = NULL;
+	expires = timers_next_expires(timers);
 	raw_spin_unlock(&timers->lock);
 
 	if (expires != ((unsigned long)~0)) {
@@ -105,41 +368,29 @@ static void run_timer_softirq(struct softirq_action *h)
 	}
 }
 
-static inline int timer_pending(const struct timer_list * timer)
-{
-	return ((timer->entry.next) != NULL);
-}
-
-static int detach_timer(struct timers *timers, struct timer_list *timer)
-{
-	struct list_head *entry = &timer->entry;
-
-	if (timer_pending(timer)) {
-		list_del(entry);
-		entry->next = NULL;
-		atomic_set(&timer->del_request, 0);
-	}
-
-	return 0;
-}
-
 static inline unsigned long slack_expires(unsigned long expires)
 {
 	return expires;
 }
 
-static int __mod_timer(struct timer_list *timer)
+/*
+ * the expires is updated with the lock of the timers
+ * held, after the timer is detached, so a concurrent
+ * expiry or del_timer never sees a half updated timer
+ */
+static int __mod_timer(struct timer_list *timer, unsigned long expires)
 {
 	unsigned long flags;
 	struct timers *timers = timer->timers;
 
-	pr_debug("modify timer to 0x%x\n", timer->expires);
+	pr_debug("modify timer to 0x%x\n", expires);
 
 	spin_lock_irqsave(&timers->lock, flags);
 
 	detach_timer(timers, timer);
-	list_add_tail(&timers->active, &timer->entry);
-	atomic_set(&timer->del_request, 0);
+	timer->expires = expires;
+	forward_timers(timers, NOW());
+	enqueue_timer(timers, timer);
 
 	/*
 	 * reprogram the timer for next event do not
@@ -147,9 +398,10 @@ static int __mod_timer(struct timer_list *timer)
 	 * also need to trigger event even if the time is
 	 * smaller than NOW()
 	 */
-	if ((timers->running_expires > timer->expires) ||
+	expires = timers_next_expires(timers);
+	if ((timers->running_expires > expires) ||
 			(timers->running_expires == 0)) {
-		timers->running_expires = timer->expires;
+		timers->running_expires = expires;
 		enable_timer(timers->running_expires);
 	}
 
@@ -167,7 +419,6 @@ int mod_timer(struct timer_list *timer, unsigned long expires)
 	preempt_disable();
 	cpu = smp_processor_id();
 	expires = slack_expires(expires);
-	timer->expires = expires;
 
 	/*
 	 * if the timer is not on the current cpu's
@@ -182,7 +433,39 @@ int mod_timer(struct timer_list *timer, unsigned long expires)
 		spin_unlock_irqrestore(&timers->lock, flags);
 	}
 
-	__mod_timer(timer);
+	__mod_timer(timer, expires);
+	preempt_enable();
+
+	return 0;
+}
+
+/*
+ * move the timer to the timers of the current cpu, if
+ * the timer is pending it will expire on this cpu at the
+ * same time
+ */
+int migrate_timer(struct timer_list *timer)
+{
+	struct timers *timers = timer->timers;
+	unsigned long flags;
+	int cpu, pending;
+
+	preempt_disable();
+	cpu = smp_processor_id();
+	if (timer->cpu == cpu) {
+		preempt_enable();
+		return 0;
+	}
+
+	spin_lock_irqsave(&timers->lock, flags);
+	pending = timer_pending(timer) && !atomic_read(&timer->del_request);
+	detach_timer(timers, timer);
+	timer->cpu = cpu;
+	timer->timers = &get_per_cpu(timers, cpu);
+	spin_unlock_irqrestore(&timers->lock, flags);
+
+	if (pending)
+		__mod_timer(timer, timer->expires);
 	preempt_enable();
 
 	return 0;
@@ -194,7 +477,8 @@ void init_timer_on_cpu(struct timer_list *timer, int cpu)
 
 	preempt_disable();
 	init_list(&timer->entry);
-	timer->entry.next = NULL;
+	timer->slot = TIMER_SLOT_NONE;
+	timer->index = TIMER_INDEX_NONE;
 	timer->expires = 0;
 	timer->function = NULL;
 	timer->data = 0;
@@ -249,12 +533,16 @@ void add_timer(struct timer_list *timer)
 
 void init_timers(void)
 {
-	int i;
+	int i, j;
 	struct timers *timers;
 
 	for (i = 0; i < CONFIG_NR_CPUS; i++) {
 		timers = &get_per_cpu(timers, i);
-		init_list(&timers->active);
+		for (j = 0; j <= TIMER_WHEEL_SLOTS; j++)
+			init_list(&timers->wheel[j]);
+		memset(timers->pending, 0, sizeof(timers->pending));
+		timers->clk = 0;
+		timers->heap_nr = 0;
 		timers->running_expires = 0;
 		spin_lock_init(&timers->lock);
 	}
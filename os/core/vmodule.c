@@ -213,6 +213,22 @@ void resume_task_vmodule_state(struct task *task)
 	}
 }
 
+/*
+ * called on the new pcpu of the task after the task
+ * is migrated to it
+ */
+void migrate_task_vmodule_state(struct task *task)
+{
+	struct vmodule *vmodule;
+	void *context;
+
+	list_for_each_entry(vmodule, &vmodule_list, list) {
+		context = task->context[vmodule->id];
+		if (vmodule->state_migrate && context)
+			vmodule->state_migrate(task, context);
+	}
+}
+
 int vmodules_init(void)
 {
 	struct module_id *mid;
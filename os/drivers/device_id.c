@@ -34,6 +34,11 @@ char *gicv3_match_table[] = {
 	NULL
 };
 
+char *gicv3_its_match_table[] = {
+	"arm,gic-v3-its",
+	NULL
+};
+
 char *bcmirq_match_table[] = {
 	"brcm,bcm2836-l1-intc",
 	NULL
@@ -32,6 +32,7 @@
 
 #define RESCHED_IRQ				(7)
 #define SMP_FUNCTION_CALL_IRQ			(6)
+#define VCPU_KICK_IRQ				(5)
 
 typedef enum sgi_mode {
 	SGI_TO_LIST = 0,
@@ -134,6 +135,7 @@ int irq_alloc_special(uint32_t start, uint32_t cnt);
 
 void __irq_enable(uint32_t irq, int enable);
 void send_sgi(uint32_t sgi, int cpu);
+void send_sgi_mask(uint32_t sgi, cpumask_t *mask);
 
 void irq_set_affinity(uint32_t irq, int cpu);
 void irq_set_type(uint32_t irq, int type);
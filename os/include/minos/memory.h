@@ -95,6 +95,16 @@ struct mm_struct {
 	struct page *head;
 	struct list_head block_list;
 
+	/*
+	 * mem_blocks - the mem_block which backs each
+	 * MEM_BLOCK_SIZE slot of the guest vm's memory, NULL
+	 * if the slot has not been touched when the vm's
+	 * memory is allocated on demand
+	 */
+	struct mem_block **mem_blocks;
+	int nr_mem_blocks;
+	int hvm_mmaped;
+
 	/*
 	 * list all the memory region for this VM, usually
 	 * native VM may have at least one memory region, but
@@ -70,6 +70,7 @@ static inline void add_slab_mem(unsigned long base, size_t size)
 struct mem_block *alloc_mem_block(unsigned long flags);
 void release_mem_block(struct mem_block *block);
 int has_enough_memory(size_t size);
+void dump_slab_cache_stat(void);
 void add_slab_mem(unsigned long base, size_t size);
 #endif
 
@@ -9,6 +9,9 @@
 
 int level_print(int level, char *fmt, ...);
 void change_log_level(unsigned int level);
+void log_flush(void);
+void log_flush_panic(void);
+size_t log_read_history(char *buf, size_t size);
 
 #define pr_debug(...)	level_print(PRINT_LEVEL_DEBUG, "DBG " __VA_ARGS__)
 #define pr_info(...)	level_print(PRINT_LEVEL_INFO,  "INF " __VA_ARGS__)
@@ -5,10 +5,18 @@
 #include <minos/list.h>
 #include <minos/timer.h>
 #include <minos/atomic.h>
+#include <minos/bitmap.h>
 #include <minos/task.h>
 
 DECLARE_PER_CPU(struct pcpu *, pcpu);
 
+#define SCHED_WEIGHT_DEFAULT	256
+#define SCHED_WEIGHT_MAX	65535
+#define SCHED_CAP_MAX		100
+
+#define SCHED_LOAD_SHIFT	10
+#define SCHED_LOAD_SCALE	(1UL << SCHED_LOAD_SHIFT)
+
 typedef enum _pcpu_state_t {
 	PCPU_STATE_RUNNING	= 0x0,
 	PCPU_STATE_IDLE,
@@ -43,6 +51,32 @@ struct pcpu {
 
 	int local_rdy_tasks;
 
+	/*
+	 * average number of the runnable percpu tasks
+	 * on this pcpu, scaled by SCHED_LOAD_SCALE
+	 */
+	unsigned long load_avg;
+
+	/*
+	 * the sched tick is stopped when the pcpu is idle
+	 * or only one percpu task can run, below are the
+	 * tick statistics, the wakeup latency is the time
+	 * from a task is set to ready to it runs
+	 */
+	int tick_stopped;
+	unsigned long nr_ticks;
+	unsigned long nr_tick_stops;
+	unsigned long max_wakeup_lat;
+
+	/*
+	 * the percpu tasks waked up by other pcpus, the
+	 * bit of the task's pid is set by the waker, and
+	 * the pcpu drains it when return from irq, only
+	 * the first waker need to send the resched sgi
+	 */
+	DECLARE_BITMAP(wake_map, OS_NR_TASKS);
+	atomic_t wake_kick;
+
 	/* sched class callback for each pcpu */
 	void (*sched)(struct pcpu *pcpu, struct task *cur);
 	void (*irq_handler)(struct pcpu *pcpu, struct task *cur);
@@ -52,6 +86,17 @@ struct pcpu {
 			struct task *next);
 };
 
+/*
+ * whether there are other percpu tasks ready on this
+ * pcpu except the one which is running or going to run
+ */
+static inline int pcpu_has_other_ready(struct pcpu *pcpu)
+{
+	struct list_head *head = &pcpu->ready_list;
+
+	return (!is_list_empty(head) && (head->next->next != head));
+}
+
 void pcpus_init(void);
 void sched(void);
 int sched_init(void);
@@ -65,5 +110,10 @@ struct task *get_highest_task(uint8_t group, prio_t *ready);
 void irq_enter(gp_regs *regs);
 void irq_exit(gp_regs *regs);
 void sched_task(struct task *task);
+void sched_clamp_param(uint32_t *weight, uint32_t *cap);
+void sched_set_task_weight(struct task *task, uint32_t weight, uint32_t cap);
+void sched_yield(void);
+int sched_yield_to(struct task *task);
+int sched_migrate_task(struct task *task, int cpu);
 
 #endif
@@ -21,5 +21,20 @@ int is_cpus_all_up(void);
 void smp_init(void);
 int smp_function_call(int cpu, smp_function fn,
 		void *data, int wait);
+int smp_function_call_many(cpumask_t *mask, smp_function fn,
+		void *data, int wait);
+void smp_call_dump_stat(void);
+
+static inline int smp_function_call_async(int cpu,
+		smp_function fn, void *data)
+{
+	return smp_function_call(cpu, fn, data, 0);
+}
+
+static inline int smp_function_call_many_async(cpumask_t *mask,
+		smp_function fn, void *data)
+{
+	return smp_function_call_many(mask, fn, data, 0);
+}
 
 #endif
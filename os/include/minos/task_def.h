@@ -101,12 +101,27 @@ struct task {
 	/*
 	 * affinity - the cpu node which the task affinity to
 	 * cpu - the cpu node which the task runing at currently
+	 * migrate_to - the cpu node which the percpu task is
+	 * moving to, PCPU_AFF_NONE if it is not migrating
 	 */
 	uint16_t affinity;
 	uint16_t cpu;
+	uint16_t migrate_to;
 
 	unsigned long run_time;
 	unsigned long start_ns;
+	unsigned long wakeup_ns;
+
+	/*
+	 * used by the fair sched class, vruntime is the
+	 * run time of the task scaled by its weight, cap
+	 * is the max percent of the pcpu it can use
+	 */
+	uint32_t weight;
+	uint32_t cap;
+	uint64_t vruntime;
+	unsigned long exec_start;
+	unsigned long cap_used;
 
 	spinlock_t lock;
 
@@ -8,12 +8,30 @@
 
 #define DEFAULT_TIMER_MARGIN	(10)
 
+/*
+ * per-cpu timers are kept in a hierarchical timer wheel,
+ * each wheel tick is 2^TIMER_WHEEL_GRAN_SHIFT ns, and the
+ * timers which will expire in TIMER_NEAR_TICKS are moved
+ * to a min-heap which sorted by the expires value
+ */
+#define TIMER_WHEEL_GRAN_SHIFT	(20)
+#define TIMER_LVL_BITS		(6)
+#define TIMER_LVL_SIZE		(1 << TIMER_LVL_BITS)
+#define TIMER_LVL_MASK		(TIMER_LVL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS	(4)
+#define TIMER_WHEEL_SLOTS	(TIMER_WHEEL_LEVELS * TIMER_LVL_SIZE)
+#define TIMER_OVERFLOW_SLOT	(TIMER_WHEEL_SLOTS)
+#define TIMER_NEAR_TICKS	(16)
+#define TIMER_HEAP_SIZE		(128)
+
 typedef void (*timer_func_t)(unsigned long);
 
 struct timer_list {
 	int cpu;
 	atomic_t del_request;
 	struct list_head entry;
+	int slot;
+	int index;
 	unsigned long expires;
 	timer_func_t function;
 	unsigned long data;
@@ -21,7 +39,11 @@ struct timer_list {
 };
 
 struct timers {
-	struct list_head active;
+	struct list_head wheel[TIMER_WHEEL_SLOTS + 1];
+	unsigned long pending[TIMER_WHEEL_LEVELS];
+	unsigned long clk;
+	struct timer_list *heap[TIMER_HEAP_SIZE];
+	int heap_nr;
 	unsigned long running_expires;
 	struct timer_list *running_timer;
 	spinlock_t lock;
@@ -32,5 +54,6 @@ void init_timer_on_cpu(struct timer_list *timer, int cpu);
 void add_timer(struct timer_list *timer);
 int del_timer(struct timer_list *timer);
 int mod_timer(struct timer_list *timer, unsigned long expires);
+int migrate_timer(struct timer_list *timer);
 
 #endif
@@ -22,6 +22,7 @@ struct vmodule {
 	void (*state_reset)(struct task *task, void *context);
 	void (*state_suspend)(struct task *task, void *context);
 	void (*state_resume)(struct task *task, void *context);
+	void (*state_migrate)(struct task *task, void *context);
 };
 
 typedef int (*vmodule_init_fn)(struct vmodule *);
@@ -35,6 +36,7 @@ void save_task_vmodule_state(struct task *task);
 void restore_task_vmodule_state(struct task *task);
 void suspend_task_vmodule_state(struct task *task);
 void resume_task_vmodule_state(struct task *task);
+void migrate_task_vmodule_state(struct task *task);
 int vmodules_init(void);
 int register_task_vmodule(const char *name, vmodule_init_fn fn);
 
@@ -28,6 +28,10 @@
 #define HVC_VM_VIRTIO_MMIO_DEINIT	HVC_VM0_FN(12)
 #define HVC_VM_CREATE_HOST_VDEV		HVC_VM0_FN(13)
 #define HVC_CHANGE_LOG_LEVEL		HVC_VM0_FN(14)
+#define HVC_GET_LOG_HISTORY		HVC_VM0_FN(15)
+#define HVC_VM_SET_SCHED		HVC_VM0_FN(16)
+#define HVC_VM_MIGRATE_VCPU		HVC_VM0_FN(17)
+#define HVC_VM_SEND_MSI			HVC_VM0_FN(18)
 
 #define HVC_MAILBOX_QUERY_INSTANCE	HVC_MAILBOX_FN(0)
 #define HVC_MAILBOX_GET_INFO		HVC_MAILBOX_FN(1)
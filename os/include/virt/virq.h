@@ -45,6 +45,22 @@ struct irqtag;
 #define MAX_HVM_VIRQ		(HVM_SPI_VIRQ_NR + VM_LOCAL_VIRQ_NR)
 #define MAX_GVM_VIRQ		(GVM_SPI_VIRQ_NR + VM_LOCAL_VIRQ_NR)
 
+/*
+ * the lpis are only provided when the vm has a virtual
+ * its, they start from intid 8192 and are posted behind
+ * the spis in the pending bitmap of the vcpu
+ */
+#ifndef CONFIG_VGIC_LPI_NR
+#define VM_LPI_VIRQ_NR		(256)
+#else
+#define VM_LPI_VIRQ_NR		CONFIG_VGIC_LPI_NR
+#endif
+
+#define VM_LPI_VIRQ_BASE	(8192)
+#define VIRQ_IS_LPI(virq)	((virq) >= VM_LPI_VIRQ_BASE)
+
+#define VIRQ_POST_NR		(MAX_HVM_VIRQ + VM_LPI_VIRQ_NR)
+
 #define VIRQS_PENDING		(1 << 0)
 #define VIRQS_ENABLED		(1 << 1)
 #define VIRQS_SUSPEND		(1 << 2)
@@ -84,6 +100,15 @@ struct virq_struct {
 	struct list_head pending_list;
 	struct list_head active_list;
 	struct virq_desc local_desc[VM_LOCAL_VIRQ_NR];
+
+	/*
+	 * the virqs sent to the vcpu are posted to the
+	 * pending bitmap without taking the lock, the vcpu
+	 * moves them to the pending list with the lock
+	 * held before it enters to guest
+	 */
+	atomic_t posted;
+	DECLARE_BITMAP(pending_bitmap, VIRQ_POST_NR);
 #if defined(CONFIG_VIRQCHIP_VGICV2) || defined(CONFIG_VIRQCHIP_VGICV3)
 #define MAX_NR_LRS 64
 	DECLARE_BITMAP(irq_bitmap, MAX_NR_LRS);
@@ -179,14 +204,19 @@ int virq_set_priority(struct vcpu *vcpu, uint32_t virq, int pr);
 int virq_set_type(struct vcpu *vcpu, uint32_t virq, int value);
 uint32_t virq_get_type(struct vcpu *vcpu, uint32_t virq);
 uint32_t virq_get_affinity(struct vcpu *vcpu, uint32_t virq);
+int virq_set_affinity(struct vcpu *vcpu, uint32_t virq, uint32_t vcpu_id);
 uint32_t virq_get_pr(struct vcpu *vcpu, uint32_t virq);
 uint32_t virq_get_state(struct vcpu *vcpu, uint32_t virq);
 uint32_t get_pending_virq(struct vcpu *vcpu);
 
 int send_virq_to_vcpu(struct vcpu *vcpu, uint32_t virq);
 int send_virq_to_vm(struct vm *vm, uint32_t virq);
+int send_msi_to_vm(struct vm *vm, uint32_t devid, uint32_t eventid);
 
 int vcpu_has_irq(struct vcpu *vcpu);
+void virq_harvest_pending(struct vcpu *vcpu);
+void virq_add_pending_list(struct virq_struct *vs, struct virq_desc *d);
+void vcpu_virq_migrate(struct vcpu *vcpu, int cpu);
 
 int alloc_vm_virq(struct vm *vm);
 void release_vm_virq(struct vm *vm, int virq);
@@ -4,6 +4,7 @@
 #include <minos/types.h>
 
 struct vcpu;
+struct vm;
 
 #define VIRQCHIP_F_HW_VIRT	(1 << 0)
 
@@ -17,6 +18,13 @@ struct virq_chip {
 	int (*send_virq)(struct vcpu *vcpu, struct virq_desc *virq);
 	int (*get_virq_state)(struct vcpu *vcpu, struct virq_desc *virq);
 	int (*update_virq)(struct vcpu *vcpu, struct virq_desc *virq, int action);
+	int (*set_maintenance)(struct vcpu *vcpu, int enable);
+
+	/* bitmap of the LRs which do not hold a valid virq */
+	uint64_t (*get_empty_lrs)(struct vcpu *vcpu);
+
+	/* translate the msi of a device to a lpi of the vm */
+	int (*send_msi)(struct vm *vm, uint32_t devid, uint32_t eventid);
 
 	/* for vgicv2 and vgicv3 that support hw virtualaztion */
 #if defined(CONFIG_VIRQCHIP_VGICV2) || defined(CONFIG_VIRQCHIP_VGICV3)
@@ -29,6 +37,7 @@ struct virq_chip {
 
 struct virq_chip *alloc_virq_chip(void);
 int virqchip_get_virq_state(struct vcpu *vcpu, struct virq_desc *virq);
+void virqchip_set_maintenance(struct vcpu *vcpu, int enable);
 void virqchip_send_virq(struct vcpu *vcpu, struct virq_desc *virq);
 void virqchip_update_virq(struct vcpu *vcpu,
 		struct virq_desc *virq, int action);
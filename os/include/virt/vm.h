@@ -40,6 +40,25 @@ struct virq_chip;
 extern struct list_head vm_list;
 extern struct list_head mem_list;
 
+/*
+ * the statistics of a vcpu, they are dumped when
+ * the vcpu is released
+ */
+struct vcpu_stat {
+	unsigned long halt_poll_success;
+	unsigned long halt_poll_fail;
+	unsigned long halt_poll_wasted;
+	unsigned long halt_poll_wasted_ns;
+	unsigned long yield_success;
+	unsigned long yield_no_target;
+	unsigned long yield_skipped;
+	unsigned long nr_migrations;
+	unsigned long nr_kicks;
+	unsigned long nr_kicks_merged;
+	unsigned long kick_lat_ns;
+	unsigned long kick_lat_max;
+};
+
 struct vcpu {
 	uint32_t vcpu_id;
 	struct vm *vm;
@@ -59,6 +78,32 @@ struct vcpu {
 
 	struct vmcs *vmcs;
 	int vmcs_irq;
+
+	/* halt polling window of this vcpu */
+	unsigned long halt_poll_ns;
+
+	/*
+	 * directed yield on wfe, the sibling vcpu which
+	 * boosted last time and the back off state
+	 */
+	int last_boosted;
+	int yield_backoff;
+	int yield_skip;
+
+	/* pinned by vm0 the balancer will not move it */
+	int pinned;
+
+	/*
+	 * the vcpu is running in guest, a kick sgi is sent
+	 * to force it exit when a virq is posted to it from
+	 * other pcpu, kick_pending suppresses the duplicate
+	 * kicks until it exits from guest
+	 */
+	int in_guest;
+	atomic_t kick_pending;
+	unsigned long kick_ns;
+
+	struct vcpu_stat stat;
 } __align_cache_line;
 
 struct vm {
@@ -78,12 +123,33 @@ struct vm {
 
 	unsigned long time_offset;
 
+	uint32_t sched_weight;
+	uint32_t sched_cap;
+
+	/*
+	 * gang sched, the vcpus of the vm are dispatched
+	 * together on their pcpus until gang_expires
+	 */
+	spinlock_t gang_lock;
+	unsigned long gang_expires;
+	unsigned long nr_gang_slices;
+
 	struct list_head vdev_list;
+	int nr_vdevs;
+	struct vdev **vdev_map;
+	int nr_vdev_map;
+	int vdev_map_size;
+	int vdev_map_nested;
 
 	uint32_t vspi_nr;
 	int virq_same_page;
 	struct virq_desc *vspi_desc;
 	unsigned long *vspi_map;
+
+	/* lpi descs, allocated by the virtual its of the vm */
+	uint32_t vlpi_nr;
+	struct virq_desc *vlpi_desc;
+
 	struct virq_chip *virq_chip;
 
 	void *vmcs;
@@ -148,6 +214,8 @@ struct vcpu *create_idle_vcpu(void);
 int vm_vcpus_init(struct vm *vm);
 
 void vcpu_idle(struct vcpu *vcpu);
+void vcpu_halt(struct vcpu *vcpu);
+void vcpu_yield(struct vcpu *vcpu);
 int vcpu_reset(struct vcpu *vcpu);
 int vcpu_suspend(struct vcpu *vcpu, gp_regs *c,
 		uint32_t state, unsigned long entry);
@@ -157,19 +225,39 @@ int vcpu_power_on(struct vcpu *caller, unsigned long affinity,
 		unsigned long entry, unsigned long unsed);
 int vcpu_power_off(struct vcpu *vcpu, int timeout);
 void kick_vcpu(struct vcpu *vcpu);
+int vcpu_kick_target(struct vcpu *vcpu);
+void vcpu_kick_stat(struct vcpu *vcpu);
+int vcpu_can_migrate(struct vcpu *vcpu, int cpu);
+int vcpu_migrate(struct vcpu *vcpu, int cpu);
 
 static inline void exit_from_guest(struct vcpu *vcpu, gp_regs *regs)
 {
+	vcpu->in_guest = 0;
+	atomic_set(&vcpu->kick_pending, 0);
+
 	do_hooks((void *)vcpu, (void *)regs, OS_HOOK_EXIT_FROM_GUEST);
 }
 
 static inline void enter_to_guest(struct vcpu *vcpu, gp_regs *regs)
 {
+	/*
+	 * mark the vcpu in guest before the posted virqs are
+	 * harvested, the virq posted after the harvest will
+	 * see the flag and kick the vcpu
+	 */
+	vcpu->in_guest = 1;
+	mb();
+
 	do_hooks((void *)vcpu, (void *)regs, OS_HOOK_ENTER_TO_GUEST);
+
+	if (vcpu->kick_ns)
+		vcpu_kick_stat(vcpu);
 }
 
 struct vm *create_vm(struct vmtag *vme);
 int create_guest_vm(struct vmtag *tag);
+int vm_set_sched_param(struct vm *vm, uint32_t weight, uint32_t cap);
+int vm_migrate_vcpu(struct vm *vm, uint32_t vcpu_id, int cpu);
 void destroy_vm(struct vm *vm);
 int vm_power_up(int vmid);
 int vm_reset(int vmid, void *args);
@@ -194,6 +282,13 @@ static inline int vm_is_native(struct vm *vm)
 	return !!(vm->flags & VM_FLAGS_NATIVE);
 }
 
+/* the same check as send_virq() does for the vm state */
+static inline int vm_can_take_virq(struct vm *vm)
+{
+	return ((vm->state != VM_STAT_OFFLINE) &&
+			(vm->state != VM_STAT_REBOOT));
+}
+
 static inline int vm_id(struct vm *vm)
 {
 	return vm->vmid;
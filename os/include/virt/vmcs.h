@@ -3,19 +3,39 @@
 
 #include <minos/types.h>
 
-struct vmcs {
-	volatile uint32_t vcpu_id;
+/*
+ * each vcpu has a ring of trap entries, the hypervisor
+ * post the trap to entries[host_index % VMCS_NR_ENTRIES]
+ * and the vm0 complete them in order, then increase the
+ * guest_index, a posted trap does not need to wait for
+ * the completion of the previous traps
+ */
+#define VMCS_NR_ENTRIES		(16)
+#define VMCS_ENTRY_MASK		(VMCS_NR_ENTRIES - 1)
+
+struct vmcs_entry {
 	volatile uint32_t trap_type;
 	volatile uint32_t trap_reason;
 	volatile int32_t  trap_ret;
+	volatile uint32_t padding;
 	volatile unsigned long trap_data;
 	volatile unsigned long trap_result;
+};
+
+struct vmcs {
+	volatile uint32_t vcpu_id;
+	volatile uint32_t nr_entries;
 	volatile uint64_t host_index;
 	volatile uint64_t guest_index;
+	struct vmcs_entry entries[VMCS_NR_ENTRIES];
 	volatile unsigned long data[0];
 } __align(1024);
 
-#define VMCS_DATA_SIZE	(1024 - 48)
+#define VMCS_DATA_SIZE	\
+	(1024 - 24 - VMCS_NR_ENTRIES * sizeof(struct vmcs_entry))
+
+#define vmcs_entry(vmcs, index)	\
+	(&(vmcs)->entries[(index) & VMCS_ENTRY_MASK])
 #define VMCS_SIZE(nr) 	PAGE_BALIGN(nr * sizeof(struct vmcs))
 
 enum vm_trap_type {
@@ -16,7 +16,8 @@ int map_vm_memory(struct vm *vm, unsigned long vir_base,
 int unmap_vm_memory(struct vm *vm, unsigned long vir_addr,
 			size_t size, int type);
 
-int alloc_vm_memory(struct vm *vm);
+int alloc_vm_memory(struct vm *vm, unsigned long prefault);
+int vm_mem_fault(struct vm *vm, unsigned long ipa);
 void release_vm_memory(struct vm *vm);
 
 int create_guest_mapping(struct vm *vm, unsigned long vir,
@@ -41,4 +42,9 @@ void vm_init_shmem(struct vm *vm, uint64_t base, uint64_t size);
 
 phy_addr_t get_vm_memblock_address(struct vm *vm, unsigned long a);
 
+int copy_from_vm_ipa(struct vm *vm, void *dst,
+		unsigned long ipa, size_t size);
+int copy_to_vm_ipa(struct vm *vm, unsigned long ipa,
+		void *src, size_t size);
+
 #endif
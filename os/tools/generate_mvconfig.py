@@ -16,12 +16,22 @@ default_config = {
     'CONFIG_MAX_VM': ['64', 1],
     'CONFIG_MINOS_RESCHED_IRQ': ['7', 1],
     'CONFIG_MAX_SLAB_BLOCKS': ['10', 1],
+    'CONFIG_SLAB_MAGAZINE_SIZE': ['16', 1],
     'CONFIG_PLATFORM_ADDRESS_RANGE': ['40', 1],
     'CONFIG_LOG_LEVEL': ['3', 1],
+    'CONFIG_LOG_BUF_SHIFT': ['14', 1],
+    'CONFIG_LOG_FLUSH_PERIOD': ['50', 1],
     'CONFIG_MINOS_START_ADDRESS': ['0x0', 1],
     'CONFIG_BOOTMEM_SIZE': ['64K', 1],
     'CONFIG_MAX_MAILBOX_NR': ['10', 1],
     'CONFIG_TASK_RUN_TIME' : ['100', 1],
+    'CONFIG_SCHED_LATENCY' : ['20', 1],
+    'CONFIG_SCHED_MIN_GRANULARITY' : ['2', 1],
+    'CONFIG_HALT_POLL_NS_MAX' : ['200000', 1],
+    'CONFIG_SCHED_BALANCE_PERIOD' : ['100', 1],
+    'CONFIG_SCHED_GANG_SLICE' : ['10', 1],
+    'CONFIG_SMP_CALL_QUEUE_SIZE' : ['16', 1],
+    'CONFIG_VGIC_LPI_NR' : ['256', 1],
 }
 
 
@@ -22,6 +22,34 @@
 #include <virt/virq.h>
 #include <virt/virtio.h>
 #include <virt/vmcs.h>
+#include <virt/vmm.h>
+
+#define HVC_LOG_HISTORY_MAX	(64 * 1024)
+
+/*
+ * copy the hypervisor log which still in the log
+ * rings to the buffer of vm0
+ */
+static int vm_get_log_history(unsigned long buf, size_t size)
+{
+	char *addr;
+	size_t copied;
+
+	if (!buf || !size)
+		return -EINVAL;
+
+	if (size > HVC_LOG_HISTORY_MAX)
+		size = HVC_LOG_HISTORY_MAX;
+
+	addr = map_vm_mem(buf, size);
+	if (!addr)
+		return -ENOMEM;
+
+	copied = log_read_history(addr, size);
+	unmap_vm_mem(buf, size);
+
+	return (int)copied;
+}
 
 static int vm_hvc_handler(gp_regs *c, uint32_t id, uint64_t *args)
 {
@@ -74,6 +102,12 @@ static int vm_hvc_handler(gp_regs *c, uint32_t id, uint64_t *args)
 		HVC_RET1(c, 0);
 		break;
 
+	case HVC_VM_SEND_MSI:
+		ret = send_msi_to_vm(get_vm_by_id((int)args[0]),
+				(uint32_t)args[1], (uint32_t)args[2]);
+		HVC_RET1(c, ret);
+		break;
+
 	case HVC_VM_CREATE_VMCS:
 		addr = vm_create_vmcs(vm);
 		HVC_RET1(c, addr);
@@ -105,6 +139,19 @@ static int vm_hvc_handler(gp_regs *c, uint32_t id, uint64_t *args)
 	case HVC_CHANGE_LOG_LEVEL:
 		change_log_level((unsigned int)args[0]);
 		break;
+	case HVC_VM_SET_SCHED:
+		ret = vm_set_sched_param(vm, (uint32_t)args[1],
+				(uint32_t)args[2]);
+		HVC_RET1(c, ret);
+		break;
+	case HVC_VM_MIGRATE_VCPU:
+		ret = vm_migrate_vcpu(vm, (uint32_t)args[1], (int)args[2]);
+		HVC_RET1(c, ret);
+		break;
+	case HVC_GET_LOG_HISTORY:
+		ret = vm_get_log_history(args[0], (size_t)args[1]);
+		HVC_RET1(c, ret);
+		break;
 	default:
 		pr_err("unsupport vm hypercall");
 		break;
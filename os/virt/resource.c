@@ -104,6 +104,12 @@ int parse_vm_info_of(struct device_node *node, struct vmtag *vmtag)
 	if (of_get_bool(node, "vm_32bit"))
 		vmtag->flags &= ~VM_FLAGS_64BIT;
 
+	if (of_get_bool(node, "gang_sched"))
+		vmtag->flags |= VM_FLAGS_GANG_SCHED;
+
+	of_get_u32_array(node, "sched_weight", &vmtag->sched_weight, 1);
+	of_get_u32_array(node, "sched_cap", &vmtag->sched_cap, 1);
+
 	return 0;
 }
 
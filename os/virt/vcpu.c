@@ -29,6 +29,16 @@
 #include <virt/vmcs.h>
 #include <minos/task.h>
 
+#ifndef CONFIG_HALT_POLL_NS_MAX
+#define CONFIG_HALT_POLL_NS_MAX	200000
+#endif
+
+#define HALT_POLL_NS_START	10000
+#define HALT_POLL_NS_GROW	2
+#define HALT_POLL_NS_SHRINK	2
+
+#define YIELD_BACKOFF_MAX	64
+
 extern unsigned char __vm_start;
 extern unsigned char __vm_end;
 
@@ -41,6 +51,8 @@ static DECLARE_BITMAP(vmid_bitmap, CONFIG_MAX_VM);
 static LIST_HEAD(vmtag_list);
 LIST_HEAD(vm_list);
 
+static DEFINE_SPIN_LOCK(migrate_lock);
+
 static int alloc_new_vmid(void)
 {
 	int vmid, start = total_vms;
@@ -159,6 +171,133 @@ void vcpu_idle(struct vcpu *vcpu)
 	}
 }
 
+static void vcpu_update_halt_poll(struct vcpu *vcpu, unsigned long block_ns)
+{
+	unsigned long val = vcpu->halt_poll_ns;
+
+	if (block_ns <= val)
+		return;
+
+	if (block_ns > CONFIG_HALT_POLL_NS_MAX) {
+		/* the vcpu blocked too long, polling only wastes time */
+		val /= HALT_POLL_NS_SHRINK;
+	} else {
+		val *= HALT_POLL_NS_GROW;
+		if (val < HALT_POLL_NS_START)
+			val = HALT_POLL_NS_START;
+		if (val > CONFIG_HALT_POLL_NS_MAX)
+			val = CONFIG_HALT_POLL_NS_MAX;
+	}
+
+	vcpu->halt_poll_ns = val;
+}
+
+/*
+ * the vcpu executes wfi, before put it to idle state
+ * spin for a while to check whether there is virq
+ * coming, if the virq comes soon, the cost of sched
+ * out and sched in the vcpu can be avoided. the poll
+ * window of each vcpu grows when the virq comes a
+ * little later than the window, and shrinks when the
+ * vcpu blocks for a long time.
+ */
+void vcpu_halt(struct vcpu *vcpu)
+{
+	unsigned long start, stop, flags;
+	int polled = 0;
+
+	start = NOW();
+
+	if (vcpu->halt_poll_ns && vcpu_can_idle(vcpu)) {
+		stop = start + vcpu->halt_poll_ns;
+
+		flags = arch_save_irqflags();
+		local_irq_enable();
+
+		do {
+			if (vcpu_has_irq(vcpu)) {
+				polled = 1;
+				break;
+			}
+
+			/* other task need to run on this pcpu */
+			if (need_resched())
+				break;
+
+			cpu_relax();
+		} while (NOW() < stop);
+
+		arch_restore_irqflags(flags);
+
+		if (polled) {
+			vcpu->stat.halt_poll_success++;
+		} else if (need_resched()) {
+			vcpu->stat.halt_poll_wasted++;
+			vcpu->stat.halt_poll_wasted_ns += NOW() - start;
+		} else {
+			vcpu->stat.halt_poll_fail++;
+			vcpu->stat.halt_poll_wasted_ns += NOW() - start;
+		}
+	}
+
+	if (!polled)
+		vcpu_idle(vcpu);
+
+	vcpu_update_halt_poll(vcpu, NOW() - start);
+}
+
+/*
+ * the vcpu executes wfe, usually it is waiting for a
+ * spinlock which hold by other vcpu of the same vm, if
+ * the lock holder is preempted on its pcpu, boost it to
+ * let it release the lock as soon as possible. the
+ * sibling is selected in round robin from the last
+ * boosted one. if there is no preempted sibling, do not
+ * search again for the next few wfe, the number grows
+ * each time the search fails.
+ */
+void vcpu_yield(struct vcpu *vcpu)
+{
+	int i, id;
+	struct vm *vm = vcpu->vm;
+	struct vcpu *target;
+
+	if (vcpu->yield_skip > 0) {
+		vcpu->yield_skip--;
+		vcpu->stat.yield_skipped++;
+		goto out;
+	}
+
+	for (i = 1; i <= vm->vcpu_nr; i++) {
+		id = (vcpu->last_boosted + i) % vm->vcpu_nr;
+		target = vm->vcpus[id];
+		if (!target || (target == vcpu))
+			continue;
+
+		/* only the preempted sibling may hold the lock */
+		if (target->task->stat != TASK_STAT_RDY)
+			continue;
+
+		if (sched_yield_to(target->task))
+			continue;
+
+		vcpu->last_boosted = id;
+		vcpu->yield_backoff = 0;
+		vcpu->stat.yield_success++;
+		goto out;
+	}
+
+	vcpu->stat.yield_no_target++;
+	if (vcpu->yield_backoff == 0)
+		vcpu->yield_backoff = 1;
+	else if (vcpu->yield_backoff < YIELD_BACKOFF_MAX)
+		vcpu->yield_backoff <<= 1;
+	vcpu->yield_skip = vcpu->yield_backoff;
+
+out:
+	sched_yield();
+}
+
 int vcpu_suspend(struct vcpu *vcpu, gp_regs *c,
 		uint32_t state, unsigned long entry)
 {
@@ -244,6 +383,10 @@ static struct vm *__create_vm(struct vmtag *vme)
 	memcpy(vm->vcpu_affinity, vme->vcpu_affinity,
 			sizeof(uint32_t) * VM_MAX_VCPU);
 	vm->flags |= vme->flags;
+	vm->sched_weight = vme->sched_weight;
+	vm->sched_cap = vme->sched_cap;
+	sched_clamp_param(&vm->sched_weight, &vm->sched_cap);
+	spin_lock_init(&vm->gang_lock);
 
 	vms[vme->vmid] = vm;
 	total_vms++;
@@ -276,20 +419,168 @@ struct vcpu *get_vcpu_by_id(uint32_t vmid, uint32_t vcpu_id)
 	return get_vcpu_in_vm(vm, vcpu_id);
 }
 
-void kick_vcpu(struct vcpu *vcpu)
+/*
+ * the virq posted to a vcpu which is running in guest on
+ * other pcpu will not be loaded into the LRs until the vcpu
+ * exits from guest, the kick sgi need to be sent to force
+ * the exit, return the pcpu to kick or -1
+ */
+static int vcpu_kick_guest(struct vcpu *vcpu)
 {
+	int cpu = vcpu->task->affinity;
+
+	mb();
+	if (!vcpu->in_guest || (cpu == smp_processor_id()))
+		return -1;
+
+	if (atomic_inc_return_old(&vcpu->kick_pending)) {
+		vcpu->stat.nr_kicks_merged++;
+		return -1;
+	}
+
+	vcpu->kick_ns = NOW();
+	vcpu->stat.nr_kicks++;
+
+	return cpu;
+}
+
+/*
+ * called when the kicked vcpu enters to guest again, the
+ * posted virqs have been loaded into the LRs now
+ */
+void vcpu_kick_stat(struct vcpu *vcpu)
+{
+	unsigned long lat = NOW() - vcpu->kick_ns;
+
+	vcpu->kick_ns = 0;
+	vcpu->stat.kick_lat_ns += lat;
+	if (lat > vcpu->stat.kick_lat_max)
+		vcpu->stat.kick_lat_max = lat;
+}
+
+/*
+ * make the vcpu ready if it is not, otherwise return the
+ * pcpu which need the kick sgi, the caller can send the
+ * kick sgis of many vcpus at one time
+ */
+int vcpu_kick_target(struct vcpu *vcpu)
+{
+	int ready = 1;
 	unsigned long flags;
 
 	task_lock_irqsave(vcpu->task, flags);
 	if (!task_is_ready(vcpu->task)) {
 		vcpu->task->stat = TASK_STAT_RDY;
 		set_task_ready(vcpu->task);
+		ready = 0;
 	}
 	task_unlock_irqrestore(vcpu->task, flags);
+
+	return ready ? vcpu_kick_guest(vcpu) : -1;
+}
+
+void kick_vcpu(struct vcpu *vcpu)
+{
+	int cpu = vcpu_kick_target(vcpu);
+
+	if (cpu >= 0)
+		send_sgi(VCPU_KICK_IRQ, cpu);
+}
+
+static int vcpu_kick_handler(uint32_t irq, void *data)
+{
+	/*
+	 * nothing need to do, the irq has made the vcpu
+	 * exit from guest, the virqs will be loaded into
+	 * the LRs when it returns to guest
+	 */
+	return 0;
+}
+
+static int vcpu_kick_init(void)
+{
+	return request_irq(VCPU_KICK_IRQ, vcpu_kick_handler,
+			0, "vcpu kick", NULL);
+}
+subsys_initcall_percpu(vcpu_kick_init);
+
+static int vcpu_sibling_on_cpu(struct vcpu *vcpu, int cpu)
+{
+	struct vcpu *tmp;
+
+	vm_for_each_vcpu(vcpu->vm, tmp) {
+		if (tmp == vcpu)
+			continue;
+
+		if ((tmp->task->affinity == cpu) ||
+				(tmp->task->migrate_to == cpu))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * whether the balancer can move the vcpu to the pcpu,
+ * the vcpus of vm0 and the pinned vcpus are not moved,
+ * and the vcpus of the same vm are never put on the
+ * same pcpu
+ */
+int vcpu_can_migrate(struct vcpu *vcpu, int cpu)
+{
+	if (vm_is_hvm(vcpu->vm) || vcpu->pinned)
+		return 0;
+
+	return !vcpu_sibling_on_cpu(vcpu, cpu);
+}
+
+/*
+ * move the vcpu to other pcpu, the vtimer and the vgic
+ * state are moved with the vcpu task, the hw irqs which
+ * bound to it are routed to the new pcpu
+ */
+int vcpu_migrate(struct vcpu *vcpu, int cpu)
+{
+	int ret;
+
+	spin_lock(&migrate_lock);
+	if (vcpu_sibling_on_cpu(vcpu, cpu))
+		ret = -EBUSY;
+	else
+		ret = sched_migrate_task(vcpu->task, cpu);
+	spin_unlock(&migrate_lock);
+
+	if (ret)
+		return ret;
+
+	vcpu_virq_migrate(vcpu, cpu);
+	vcpu->stat.nr_migrations++;
+
+	return 0;
+}
+
+static void vcpu_dump_stat(struct vcpu *vcpu)
+{
+	struct vcpu_stat *stat = &vcpu->stat;
+
+	pr_debug("vcpu-%d halt poll success:%lu fail:%lu wasted:%lu %luns\n",
+			vcpu->vcpu_id, stat->halt_poll_success,
+			stat->halt_poll_fail, stat->halt_poll_wasted,
+			stat->halt_poll_wasted_ns);
+	pr_debug("vcpu-%d yield success:%lu no_target:%lu skipped:%lu\n",
+			vcpu->vcpu_id, stat->yield_success,
+			stat->yield_no_target, stat->yield_skipped);
+	pr_debug("vcpu-%d migrations:%lu kicks:%lu merged:%lu lat avg:%luns max:%luns\n",
+			vcpu->vcpu_id, stat->nr_migrations, stat->nr_kicks,
+			stat->nr_kicks_merged,
+			stat->nr_kicks ? stat->kick_lat_ns / stat->nr_kicks : 0,
+			stat->kick_lat_max);
 }
 
 static void release_vcpu(struct vcpu *vcpu)
 {
+	vcpu_dump_stat(vcpu);
+
 	if (vcpu->task)
 		release_task(vcpu->task);
 
@@ -313,6 +604,8 @@ static struct vcpu *alloc_vcpu(void)
 		goto free_vcpu;
 
 	vcpu->vmcs_irq = -1;
+	if (CONFIG_HALT_POLL_NS_MAX)
+		vcpu->halt_poll_ns = HALT_POLL_NS_START;
 	return vcpu;
 
 free_vcpu:
@@ -352,6 +645,8 @@ static struct vcpu *create_vcpu(struct vm *vm, uint32_t vcpu_id)
 	if (!(vm->flags & VM_FLAGS_64BIT))
 		task->flags |= TASK_FLAGS_32BIT;
 
+	sched_set_task_weight(task, vm->sched_weight, vm->sched_cap);
+
 	init_list(&vcpu->list);
 
 	vcpu_virq_struct_init(vcpu);
@@ -441,7 +736,7 @@ void destroy_vm(struct vm *vm)
 	 * 6 : do vmodule deinit
 	 */
 	list_for_each_entry_safe(vdev, n, &vm->vdev_list, list) {
-		list_del(&vdev->list);
+		vdev_del(vdev);
 		if (vdev->deinit)
 			vdev->deinit(vdev);
 	}
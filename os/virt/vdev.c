@@ -34,6 +34,182 @@ void vdev_set_name(struct vdev *vdev, char *name)
 	strncpy(vdev->name, name, len);
 }
 
+/*
+ * the vdevs of a vm are also kept in an array sorted by
+ * the base address of their mmio region, so the handler
+ * of a trapped address can be found by binary search
+ * instead of walking the vdev list. the map is updated
+ * when the vm is created or destroyed, not while the
+ * vcpus of the vm are running.
+ *
+ * the regions may be nested, for example the vgicv3 vdev
+ * covers GICD to the end of GICR and the vits sits in the
+ * hole between them, in this case the vdev with the biggest
+ * base which still contains the address is the inner one.
+ */
+static int vdev_map_search(struct vm *vm, unsigned long address)
+{
+	int left = 0, right = vm->nr_vdev_map - 1, mid;
+	int index = -1;
+
+	while (left <= right) {
+		mid = (left + right) >> 1;
+		if (vm->vdev_map[mid]->gvm_paddr <= address) {
+			index = mid;
+			left = mid + 1;
+		} else {
+			right = mid - 1;
+		}
+	}
+
+	return index;
+}
+
+static inline int vdev_contain(struct vdev *vdev, unsigned long address)
+{
+	return ((address >= vdev->gvm_paddr) &&
+			(address < vdev->gvm_paddr + vdev->mem_size));
+}
+
+static struct vdev *vdev_map_lookup(struct vm *vm, unsigned long address)
+{
+	int index;
+	struct vdev *vdev;
+
+	/*
+	 * if the address is out of the range of the vdev
+	 * found, it may still be inside an outer vdev which
+	 * has a lower base, walk back only if the map has
+	 * nested regions
+	 */
+	for (index = vdev_map_search(vm, address); index >= 0; index--) {
+		vdev = vm->vdev_map[index];
+		if (address < vdev->gvm_paddr + vdev->mem_size)
+			return vdev;
+
+		if (!vm->vdev_map_nested)
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * check the new vdev against its neighbours in the map, a
+ * nested region is allowed, but a region which partly
+ * overlaps another one can not be resolved correctly
+ */
+static void vdev_map_check(struct vm *vm, int index)
+{
+	struct vdev *vdev = vm->vdev_map[index];
+	unsigned long end = vdev->gvm_paddr + vdev->mem_size;
+	struct vdev *prev, *next;
+	int i;
+
+	for (i = index - 1; i >= 0; i--) {
+		prev = vm->vdev_map[i];
+		if (!vdev_contain(prev, vdev->gvm_paddr))
+			continue;
+
+		vm->vdev_map_nested = 1;
+		if (end > prev->gvm_paddr + prev->mem_size)
+			pr_warn("vdev@0x%p overlaps vdev@0x%p in vm-%d\n",
+					vdev->gvm_paddr, prev->gvm_paddr,
+					vm->vmid);
+	}
+
+	for (i = index + 1; i < vm->nr_vdev_map; i++) {
+		next = vm->vdev_map[i];
+		if (next->gvm_paddr >= end)
+			break;
+
+		vm->vdev_map_nested = 1;
+		if (next->gvm_paddr + next->mem_size > end)
+			pr_warn("vdev@0x%p overlaps vdev@0x%p in vm-%d\n",
+					next->gvm_paddr, vdev->gvm_paddr,
+					vm->vmid);
+	}
+
+	if (vdev_map_lookup(vm, vdev->gvm_paddr) != vdev)
+		pr_err("vdev@0x%p is shadowed in vm-%d\n",
+				vdev->gvm_paddr, vm->vmid);
+}
+
+static int vdev_map_insert(struct vm *vm, struct vdev *vdev)
+{
+	int i, index, size;
+	struct vdev **map;
+
+	if (vm->nr_vdev_map == vm->vdev_map_size) {
+		size = vm->vdev_map_size ? vm->vdev_map_size * 2 : 8;
+		map = malloc(sizeof(struct vdev *) * size);
+		if (!map)
+			return -ENOMEM;
+
+		if (vm->vdev_map) {
+			memcpy(map, vm->vdev_map, sizeof(struct vdev *) *
+					vm->nr_vdev_map);
+			free(vm->vdev_map);
+		}
+
+		vm->vdev_map = map;
+		vm->vdev_map_size = size;
+	}
+
+	index = vdev_map_search(vm, vdev->gvm_paddr) + 1;
+	for (i = vm->nr_vdev_map; i > index; i--)
+		vm->vdev_map[i] = vm->vdev_map[i - 1];
+
+	vm->vdev_map[index] = vdev;
+	vm->nr_vdev_map++;
+	vdev_map_check(vm, index);
+
+	return 0;
+}
+
+static void vdev_map_remove(struct vm *vm, struct vdev *vdev)
+{
+	int i, index;
+
+	for (index = 0; index < vm->nr_vdev_map; index++) {
+		if (vm->vdev_map[index] == vdev)
+			break;
+	}
+
+	if (index == vm->nr_vdev_map)
+		return;
+
+	for (i = index; i < vm->nr_vdev_map - 1; i++)
+		vm->vdev_map[i] = vm->vdev_map[i + 1];
+
+	vm->nr_vdev_map--;
+	if (vm->nr_vdev_map == 0) {
+		free(vm->vdev_map);
+		vm->vdev_map = NULL;
+		vm->vdev_map_size = 0;
+	}
+}
+
+static void vdev_add(struct vm *vm, struct vdev *vdev)
+{
+	list_add_tail(&vm->vdev_list, &vdev->list);
+	vm->nr_vdevs++;
+
+	/*
+	 * if the map can not be extended, the vdev can still
+	 * be found by the slow path in vdev_mmio_emulation
+	 */
+	if (vdev_map_insert(vm, vdev))
+		pr_warn("vdev map of vm-%d is full\n", vm->vmid);
+}
+
+void vdev_del(struct vdev *vdev)
+{
+	list_del(&vdev->list);
+	vdev->vm->nr_vdevs--;
+	vdev_map_remove(vdev->vm, vdev);
+}
+
 void vdev_release(struct vdev *vdev)
 {
 	if (vdev->iomem)
@@ -84,7 +260,7 @@ int iomem_vdev_init(struct vm *vm, struct vdev *vdev, uint32_t size)
 	vdev->deinit = vdev_deinit;
 	vdev->list.next = NULL;
 	vdev->host = 0;
-	list_add_tail(&vm->vdev_list, &vdev->list);
+	vdev_add(vm, vdev);
 
 	return 0;
 }
@@ -120,7 +296,7 @@ int host_vdev_init(struct vm *vm, struct vdev *vdev,
 	vdev->host = 1;
 	vdev->list.next = NULL;
 	vdev->deinit = vdev_deinit;
-	list_add_tail(&vm->vdev_list, &vdev->list);
+	vdev_add(vm, vdev);
 
 	return 0;
 }
@@ -168,14 +344,24 @@ int vdev_mmio_emulation(gp_regs *regs, int write,
 	struct vm *vm = get_current_vm();
 	struct vdev *vdev;
 
-	list_for_each_entry(vdev, &vm->vdev_list, list) {
-		if ((address >= vdev->gvm_paddr) &&
-			(address < vdev->gvm_paddr + vdev->mem_size)) {
-			if (write)
-				return vdev->write(vdev, regs, address, value);
-			else
-				return vdev->read(vdev, regs, address, value);
+	vdev = vdev_map_lookup(vm, address);
+
+	/* the map is not complete, fall back to the vdev list */
+	if (!vdev && (vm->nr_vdev_map != vm->nr_vdevs)) {
+		list_for_each_entry(vdev, &vm->vdev_list, list) {
+			if (vdev_contain(vdev, address))
+				break;
 		}
+
+		if (&vdev->list == &vm->vdev_list)
+			vdev = NULL;
+	}
+
+	if (vdev) {
+		if (write)
+			return vdev->write(vdev, regs, address, value);
+		else
+			return vdev->read(vdev, regs, address, value);
 	}
 
 	/*
@@ -30,53 +30,134 @@ get_virq_desc(struct vcpu *vcpu, uint32_t virq)
 	if (virq < VM_LOCAL_VIRQ_NR)
 		return &vcpu->virq_struct->local_desc[virq];
 
+	if (VIRQ_IS_LPI(virq)) {
+		if (virq - VM_LPI_VIRQ_BASE >= vm->vlpi_nr)
+			return NULL;
+		return &vm->vlpi_desc[virq - VM_LPI_VIRQ_BASE];
+	}
+
 	if (virq >= VM_VIRQ_NR(vm->vspi_nr))
 		return NULL;
 
 	return &vm->vspi_desc[VIRQ_SPI_OFFSET(virq)];
 }
 
+/* the lpis are posted behind the spis in the pending bitmap */
+static inline int virq_to_post_bit(uint32_t virq)
+{
+	if (VIRQ_IS_LPI(virq))
+		return virq - VM_LPI_VIRQ_BASE + MAX_HVM_VIRQ;
+
+	return virq;
+}
+
+static inline uint32_t post_bit_to_virq(int bit)
+{
+	if (bit >= MAX_HVM_VIRQ)
+		return bit - MAX_HVM_VIRQ + VM_LPI_VIRQ_BASE;
+
+	return bit;
+}
+
 static void inline virq_kick_vcpu(struct vcpu *vcpu,
 		struct virq_desc *desc)
 {
 	kick_vcpu(vcpu);
 }
 
+/*
+ * post the virq to the pending bitmap of the vcpu, the
+ * sender does not take the lock of the virq struct, so
+ * it does not contend with the vcpu which is updating
+ * its LRs, if the virq is already posted, do nothing
+ */
 static int inline __send_virq(struct vcpu *vcpu, struct virq_desc *desc)
 {
-	unsigned long flags;
 	struct virq_struct *virq_struct = vcpu->virq_struct;
-
-	spin_lock_irqsave(&virq_struct->lock, flags);
+	int bit = virq_to_post_bit(desc->vno);
 
 	/*
-	 * if the virq is already at the pending state, do
-	 * nothing, other case need to send it to the vcpu
-	 * if the virq is in offline state, send it to vcpu
-	 * directly
+	 * the source of a sgi is only recorded by the sender
+	 * which posts it first, the later senders are merged
+	 * into the pending one and must not change the
+	 * requester the guest will see
 	 */
-	if (virq_is_pending(desc)) {
-		spin_unlock_irqrestore(&virq_struct->lock, flags);
-		return 0;
+	if ((desc->vno < VM_SGI_VIRQ_NR) && !virq_is_pending(desc) &&
+			!test_bit(bit, virq_struct->pending_bitmap)) {
+		desc->src = get_vcpu_id(get_current_vcpu());
+		wmb();
 	}
 
-	virq_set_pending(desc);
-	dsb();
+	if (test_and_set_bit(bit, virq_struct->pending_bitmap))
+		return 0;
 
-	/*
-	 * if desc->list.next is not NULL, the virq is in
-	 * actvie or pending list do not change it
-	 */
-	if (desc->list.next == NULL) {
-		list_add_tail(&virq_struct->pending_list, &desc->list);
-		virq_struct->active_count++;
+	wmb();
+	atomic_set(&virq_struct->posted, 1);
+
+	return 0;
+}
+
+/*
+ * the pending list is sorted by the priority of the
+ * virq, virqs with the same priority keep FIFO order
+ */
+void virq_add_pending_list(struct virq_struct *vs,
+		struct virq_desc *d)
+{
+	struct virq_desc *tmp;
+
+	list_for_each_entry(tmp, &vs->pending_list, list) {
+		if (d->pr < tmp->pr) {
+			list_add_tail(&tmp->list, &d->list);
+			return;
+		}
 	}
 
-	if (desc->vno < VM_SGI_VIRQ_NR)
-		desc->src = get_vcpu_id(get_current_vcpu());
+	list_add_tail(&vs->pending_list, &d->list);
+}
 
-	spin_unlock_irqrestore(&virq_struct->lock, flags);
-	return 0;
+/*
+ * move the posted virqs to the pending list, need to be
+ * called with the lock of the virq struct held, the
+ * posted flag is cleared before the bitmap is scanned,
+ * the virq posted after the scan will set it again
+ */
+void virq_harvest_pending(struct vcpu *vcpu)
+{
+	int bit, nr;
+	struct virq_desc *desc;
+	struct virq_struct *virq_struct = vcpu->virq_struct;
+
+	if (atomic_read(&virq_struct->posted) == 0)
+		return;
+
+	atomic_set(&virq_struct->posted, 0);
+	mb();
+
+	if (vcpu->vm->vlpi_nr)
+		nr = MAX_HVM_VIRQ + vcpu->vm->vlpi_nr;
+	else
+		nr = VM_VIRQ_NR(vcpu->vm->vspi_nr);
+
+	for_each_set_bit(bit, virq_struct->pending_bitmap, nr) {
+		if (!test_and_clear_bit(bit, virq_struct->pending_bitmap))
+			continue;
+
+		desc = get_virq_desc(vcpu, post_bit_to_virq(bit));
+		if (!desc || virq_is_pending(desc))
+			continue;
+
+		virq_set_pending(desc);
+
+		/*
+		 * if desc->list.next is not NULL, the virq is in
+		 * actvie or pending list do not change it
+		 */
+		if (desc->list.next == NULL) {
+			virq_add_pending_list(virq_struct, desc);
+			virq_struct->active_count++;
+		}
+	}
 }
 
 static int send_virq(struct vcpu *vcpu, struct virq_desc *desc)
@@ -174,6 +255,36 @@ uint32_t virq_get_affinity(struct vcpu *vcpu, uint32_t virq)
 	return desc->vcpu_id;
 }
 
+/*
+ * route the spi to the vcpu which the guest programs, the
+ * hw irq bound to the spi follows the pcpu of the vcpu
+ */
+int virq_set_affinity(struct vcpu *vcpu, uint32_t virq, uint32_t vcpu_id)
+{
+	struct vcpu *target;
+	struct virq_desc *desc;
+
+	if ((virq < VM_LOCAL_VIRQ_NR) || VIRQ_IS_LPI(virq))
+		return -EINVAL;
+
+	desc = get_virq_desc(vcpu, virq);
+	if (!desc)
+		return -ENOENT;
+
+	target = get_vcpu_in_vm(vcpu->vm, vcpu_id);
+	if (!target)
+		return -EINVAL;
+
+	if (desc->vcpu_id == vcpu_id)
+		return 0;
+
+	desc->vcpu_id = vcpu_id;
+	if (virq_is_hw(desc))
+		irq_set_affinity(desc->hno, vcpu_affinity(target));
+
+	return 0;
+}
+
 uint32_t virq_get_pr(struct vcpu *vcpu, uint32_t virq)
 {
 	struct virq_desc *desc;
@@ -297,18 +408,59 @@ int send_virq_to_vm(struct vm *vm, uint32_t virq)
 	return send_virq(vcpu, desc);
 }
 
+/*
+ * the msi is translated to a lpi by the virtual its
+ * of the vm, the devid and eventid are the same as
+ * the ones the device will write to GITS_TRANSLATER
+ */
+int send_msi_to_vm(struct vm *vm, uint32_t devid, uint32_t eventid)
+{
+	struct virq_chip *vc;
+
+	if (!vm)
+		return -EINVAL;
+
+	vc = vm->virq_chip;
+	if (!vc || !vc->send_msi)
+		return -ENOENT;
+
+	return vc->send_msi(vm, devid, eventid);
+}
+
+/*
+ * post the sgi to all the target vcpus first and then kick
+ * them, the kick sgis of the vcpus running in guest are sent
+ * by one call, the wakeups of the vcpus on the same remote
+ * pcpu are merged by the wake map of the pcpu
+ */
 void send_vsgi(struct vcpu *sender, uint32_t sgi, cpumask_t *cpumask)
 {
-	int cpu;
+	int id, cpu, nr_kicks = 0;
+	cpumask_t kicks;
 	struct vcpu *vcpu;
 	struct vm *vm = sender->vm;
-	struct virq_desc *desc;
 
-	for_each_set_bit(cpu, cpumask->bits, vm->vcpu_nr) {
-		vcpu = vm->vcpus[cpu];
-		desc = get_virq_desc(vcpu, sgi);
-		send_virq(vcpu, desc);
+	if ((sgi >= VM_SGI_VIRQ_NR) || (vm->state == VM_STAT_OFFLINE) ||
+			(vm->state == VM_STAT_REBOOT))
+		return;
+
+	for_each_set_bit(id, cpumask->bits, vm->vcpu_nr) {
+		vcpu = vm->vcpus[id];
+		__send_virq(vcpu, get_virq_desc(vcpu, sgi));
+	}
+
+	cpumask_clearall(&kicks);
+
+	for_each_set_bit(id, cpumask->bits, vm->vcpu_nr) {
+		cpu = vcpu_kick_target(vm->vcpus[id]);
+		if (cpu >= 0) {
+			cpumask_set_cpu(cpu, &kicks);
+			nr_kicks++;
+		}
 	}
+
+	if (nr_kicks)
+		send_sgi_mask(VCPU_KICK_IRQ, &kicks);
 }
 
 void clear_pending_virq(struct vcpu *vcpu, uint32_t irq)
@@ -331,13 +483,14 @@ void clear_pending_virq(struct vcpu *vcpu, uint32_t irq)
 	 *
 	 */
 	spin_lock_irqsave(&virq_struct->lock, flags);
+	virq_harvest_pending(vcpu);
 	if (desc->list.next != NULL) {
 		list_del(&desc->list);
 		desc->list.next = NULL;
 	}
 
 	if (virq_is_pending(desc)) {
-		list_add_tail(&virq_struct->pending_list, &desc->list);
+		virq_add_pending_list(virq_struct, desc);
 		desc->state = VIRQ_STATE_PENDING;
 		goto out;
 	}
@@ -355,6 +508,7 @@ uint32_t get_pending_virq(struct vcpu *vcpu)
 	struct virq_struct *virq_struct = vcpu->virq_struct;
 
 	spin_lock_irqsave(&virq_struct->lock, flags);
+	virq_harvest_pending(vcpu);
 	if (is_list_empty(&virq_struct->pending_list)) {
 		spin_unlock_irqrestore(&virq_struct->lock, flags);
 		return BAD_IRQ;
@@ -381,7 +535,25 @@ int vcpu_has_irq(struct vcpu *vcpu)
 	pend = is_list_empty(&vs->pending_list);
 	active = is_list_empty(&vs->active_list);
 
-	return !(pend && active);
+	return !(pend && active) || atomic_read(&vs->posted);
+}
+
+/*
+ * route the hw irqs which are bound to the vcpu to its
+ * new pcpu, the pending and active virqs are kept in the
+ * virq struct of the vcpu and move with it
+ */
+void vcpu_virq_migrate(struct vcpu *vcpu, int cpu)
+{
+	int i;
+	struct virq_desc *desc;
+	struct vm *vm = vcpu->vm;
+
+	for_each_set_bit(i, vm->vspi_map, vm->vspi_nr) {
+		desc = &vm->vspi_desc[i];
+		if (virq_is_hw(desc) && (desc->vcpu_id == vcpu->vcpu_id))
+			irq_set_affinity(desc->hno, cpu);
+	}
 }
 
 void vcpu_virq_struct_reset(struct vcpu *vcpu)
@@ -397,6 +569,9 @@ void vcpu_virq_struct_reset(struct vcpu *vcpu)
 	virq_struct->pending_virq = 0;
 	virq_struct->pending_hirq = 0;
 	memset(virq_struct->irq_bitmap, 0, sizeof(virq_struct->irq_bitmap));
+	atomic_set(&virq_struct->posted, 0);
+	memset(virq_struct->pending_bitmap, 0,
+			sizeof(virq_struct->pending_bitmap));
 
 	for (i = 0; i < VM_LOCAL_VIRQ_NR; i++) {
 		desc = &virq_struct->local_desc[i];
@@ -434,6 +609,9 @@ void vcpu_virq_struct_init(struct vcpu *vcpu)
 	init_list(&virq_struct->active_list);
 	virq_struct->pending_virq = 0;
 	virq_struct->pending_hirq = 0;
+	atomic_set(&virq_struct->posted, 0);
+	memset(virq_struct->pending_bitmap, 0,
+			sizeof(virq_struct->pending_bitmap));
 
 	memset(&virq_struct->local_desc, 0,
 		sizeof(struct virq_desc) * VM_LOCAL_VIRQ_NR);
@@ -38,13 +38,67 @@
  * • Having two or more interrupts with the same pINTID in the Lis
  *   registers for a single virtual CPU interface.
  */
+/*
+ * find the lowest priority virq which is in the LR and
+ * still not acked by the guest, if its priority is lower
+ * than the new virq, then the LR can be preempted
+ */
+static struct virq_desc *vgic_find_preempt_virq(struct vcpu *vcpu,
+		struct virq_desc *virq)
+{
+	struct virq_desc *tmp, *victim = NULL;
+	struct virq_struct *virq_struct = vcpu->virq_struct;
+
+	list_for_each_entry(tmp, &virq_struct->active_list, list) {
+		if ((tmp->id == VIRQ_INVALID_ID) || (tmp->pr <= virq->pr))
+			continue;
+
+		if (virqchip_get_virq_state(vcpu, tmp) != VIRQ_STATE_PENDING)
+			continue;
+
+		if (!victim || (tmp->pr > victim->pr))
+			victim = tmp;
+	}
+
+	return victim;
+}
+
+static int vgic_preempt_lr(struct vcpu *vcpu, struct virq_desc *virq)
+{
+	int id;
+	struct virq_desc *victim;
+
+	victim = vgic_find_preempt_virq(vcpu, virq);
+	if (!victim)
+		return VIRQ_INVALID_ID;
+
+	pr_debug("virq %d preempt the LR of virq %d\n",
+			virq->vno, victim->vno);
+
+	/*
+	 * put the preempted virq back to the pending list
+	 * it will be injected again when there is free LR
+	 */
+	id = victim->id;
+	virqchip_update_virq(vcpu, victim, VIRQ_ACTION_CLEAR);
+	victim->id = VIRQ_INVALID_ID;
+	victim->state = VIRQ_STATE_INACTIVE;
+	virq_set_pending(victim);
+	list_del(&victim->list);
+	virq_add_pending_list(vcpu->virq_struct, victim);
+
+	return id;
+}
+
 int vgic_irq_enter_to_guest(struct vcpu *vcpu, void *data)
 {
 	/*
 	 * here we send the real virq to the vcpu
-	 * before it enter to guest
+	 * before it enter to guest, the pending list
+	 * is sorted by priority, so the virq which has
+	 * higher priority will get the LR first
 	 */
-	int id = 0;
+	int id = 0, overflow = 0;
 	struct virq_desc *virq, *n;
 	struct virq_chip *vc = vcpu->vm->virq_chip;
 	struct virq_struct *virq_struct = vcpu->virq_struct;
@@ -76,11 +130,19 @@ int vgic_irq_enter_to_guest(struct vcpu *vcpu, void *data)
 		if (virq->id != VIRQ_INVALID_ID)
 			goto __do_send_virq;
 
-		/* allocate a id for the virq */
+		/*
+		 * allocate a id for the virq, if all the LRs
+		 * are used, try to preempt a LR which hold a
+		 * lower priority virq, otherwise the left virqs
+		 * will be injected when the LRs are drained
+		 */
 		id = find_next_zero_bit(virq_struct->irq_bitmap, vc->nr_lrs, 0);
 		if (id == vc->nr_lrs) {
-			pr_warn("virq id is full can not send all virq\n");
-			break;
+			id = vgic_preempt_lr(vcpu, virq);
+			if (id == VIRQ_INVALID_ID) {
+				overflow = 1;
+				break;
+			}
 		}
 
 		virq->id = id;
@@ -95,6 +157,13 @@ __do_send_virq:
 		list_add_tail(&virq_struct->active_list, &virq->list);
 	}
 
+	/*
+	 * enable the underflow maintenance irq if some virqs
+	 * can not get a LR, then the vcpu will exit from guest
+	 * when the LRs are drained and refill them
+	 */
+	virqchip_set_maintenance(vcpu, overflow);
+
 	return 0;
 }
 
@@ -106,13 +175,27 @@ int vgic_irq_exit_from_guest(struct vcpu *vcpu, void *data)
 	 * on percpu and hanlde per_vcpu's data so do not
 	 * need spinlock
 	 */
-	int status;
+	int status, empty;
+	uint64_t empty_lrs = 0;
 	struct virq_desc *virq, *n;
+	struct virq_chip *vc = vcpu->vm->virq_chip;
 	struct virq_struct *virq_struct = vcpu->virq_struct;
 
-	list_for_each_entry_safe(virq, n, &virq_struct->active_list, list) {
+	/*
+	 * the LR which is empty means the virq has been
+	 * handled by the guest, only the LRs which still
+	 * hold a virq need to be read back
+	 */
+	if (vc->get_empty_lrs)
+		empty_lrs = vc->get_empty_lrs(vcpu);
 
-		status = virqchip_get_virq_state(vcpu, virq);
+	list_for_each_entry_safe(virq, n, &virq_struct->active_list, list) {
+		empty = (virq->id < vc->nr_lrs) &&
+			(empty_lrs & (1UL << virq->id));
+		if (empty)
+			status = VIRQ_STATE_INACTIVE;
+		else
+			status = virqchip_get_virq_state(vcpu, virq);
 
 		/*
 		 * the virq has been handled by the VCPU, if
@@ -122,7 +205,9 @@ int vgic_irq_exit_from_guest(struct vcpu *vcpu, void *data)
 		 */
 		if (status == VIRQ_STATE_INACTIVE) {
 			if (!virq_is_pending(virq)) {
-				virqchip_update_virq(vcpu, virq, VIRQ_ACTION_CLEAR);
+				if (!empty)
+					virqchip_update_virq(vcpu, virq,
+							VIRQ_ACTION_CLEAR);
 				clear_bit(virq->id, virq_struct->irq_bitmap);
 				virq->state = VIRQ_STATE_INACTIVE;
 				list_del(&virq->list);
@@ -130,9 +215,11 @@ int vgic_irq_exit_from_guest(struct vcpu *vcpu, void *data)
 				virq->list.next = NULL;
 				virq_struct->active_count--;
 			} else {
-				virqchip_update_virq(vcpu, virq, VIRQ_ACTION_CLEAR);
+				if (!empty)
+					virqchip_update_virq(vcpu, virq,
+							VIRQ_ACTION_CLEAR);
 				list_del(&virq->list);
-				list_add_tail(&virq_struct->pending_list, &virq->list);
+				virq_add_pending_list(virq_struct, virq);
 			}
 		} else
 			virq->state = status;
@@ -61,6 +61,7 @@ struct vgicc {
 };
 
 static int gicv2_nr_lrs;
+static uint32_t gicv2_maintenance_irq;
 static struct vgicv2_info vgicv2_info;
 
 #define vdev_to_vgicv2(vdev) \
@@ -105,6 +106,11 @@ static void vgicv2_set_virq_type(struct vcpu *vcpu,
 	}
 }
 
+/*
+ * the GICD_ITARGETSR can be accessed by byte, the offset
+ * is the first virq, the unused bytes of a byte access
+ * are zero
+ */
 static uint32_t vgicv2_get_virq_affinity(struct vcpu *vcpu,
 		unsigned long offset)
 {
@@ -112,8 +118,7 @@ static uint32_t vgicv2_get_virq_affinity(struct vcpu *vcpu,
 	int irq;
 	uint32_t value = 0, t;
 
-	offset = (offset - GICD_ITARGETSR) / 4;
-	irq = 4 * offset;
+	irq = offset - GICD_ITARGETSR;
 
 	for (i = 0; i < 4; i++, irq++) {
 		t = virq_get_affinity(vcpu, irq);
@@ -123,6 +128,22 @@ static uint32_t vgicv2_get_virq_affinity(struct vcpu *vcpu,
 	return value;
 }
 
+static void vgicv2_set_virq_affinity(struct vcpu *vcpu,
+		unsigned long offset, uint32_t value)
+{
+	int i, irq;
+	uint32_t mask;
+
+	irq = offset - GICD_ITARGETSR;
+
+	/* only one target is supported, use the lowest cpu */
+	for (i = 0; i < 4; i++, irq++) {
+		mask = (value >> (8 * i)) & 0xff;
+		if (mask)
+			virq_set_affinity(vcpu, irq, __ffs(mask));
+	}
+}
+
 static uint32_t vgicv2_get_virq_pr(struct vcpu *vcpu,
 		unsigned long offset)
 {
@@ -217,7 +238,7 @@ static int vgicv2_read(struct vcpu *vcpu, struct vgicv2_dev *gic,
 		*value |= tmp << 16;
 		*value |= tmp << 24;
 		break;
-	case GICD_ITARGETSR8...GICD_ITARGETSRN:
+	case GICD_ITARGETSR8...(GICD_ITARGETSRN + 3):
 		*value = vgicv2_get_virq_affinity(vcpu, offset);
 		break;
 	case GICD_ICFGR...GICD_ICFGRN:
@@ -239,7 +260,6 @@ void vgicv2_send_sgi(struct vcpu *vcpu, uint32_t sgi_value)
 	cpumask_t cpumask;
 	unsigned long list;
 	struct vm *vm = vcpu->vm;
-	struct vcpu *target;
 
 	cpumask_clearall(&cpumask);
 	list = (sgi_value >> 16) & 0xff;
@@ -260,12 +280,9 @@ void vgicv2_send_sgi(struct vcpu *vcpu, uint32_t sgi_value)
 			cpumask_set_cpu(bit, &cpumask);
 		}
 	} else
-		cpumask_set_cpu(smp_processor_id(), &cpumask);
+		cpumask_set_cpu(get_vcpu_id(vcpu), &cpumask);
 
-	for_each_cpu(bit, &cpumask) {
-		target = get_vcpu_in_vm(vm, bit);
-		send_virq_to_vcpu(target, sgi);
-	}
+	send_vsgi(vcpu, sgi, &cpumask);
 }
 
 static int vgicv2_write(struct vcpu *vcpu, struct vgicv2_dev *gic,
@@ -316,8 +333,8 @@ static int vgicv2_write(struct vcpu *vcpu, struct vgicv2_dev *gic,
 		bit = (t & 0xff000000) >> 24;
 		virq_set_priority(vcpu, y + 4, bit);
 		break;
-	case GICD_ITARGETSR8...GICD_ITARGETSRN:
-		/* to be done */
+	case GICD_ITARGETSR8...(GICD_ITARGETSRN + 3):
+		vgicv2_set_virq_affinity(vcpu, offset, value);
 		break;
 	case GICD_ICFGR...GICD_ICFGRN:
 		vgicv2_set_virq_type(vcpu, offset, value);
@@ -543,6 +560,45 @@ static int gicv2_update_virq(struct vcpu *vcpu,
 	return 0;
 }
 
+static uint64_t gicv2_get_empty_lrs(struct vcpu *vcpu)
+{
+	uint64_t value = readl_gich(GICH_ELSR0);
+
+	if (gicv2_nr_lrs > 32)
+		value |= (uint64_t)readl_gich(GICH_ELSR1) << 32;
+
+	return value;
+}
+
+static int gicv2_set_maintenance(struct vcpu *vcpu, int enable)
+{
+	uint32_t value;
+
+	value = readl_gich(GICH_HCR);
+	if (enable == !!(value & GICH_HCR_UIE))
+		return 0;
+
+	if (enable)
+		value |= GICH_HCR_UIE;
+	else
+		value &= ~GICH_HCR_UIE;
+
+	writel_gich(value, GICH_HCR);
+	isb();
+
+	return 0;
+}
+
+static int gicv2_maintenance_handler(uint32_t irq, void *data)
+{
+	/*
+	 * the LRs have been updated when exit from guest
+	 * disable the underflow irq here, the remaining
+	 * virqs will be injected when enter to guest
+	 */
+	return gicv2_set_maintenance(NULL, 0);
+}
+
 static int vgicv2_init_virqchip(struct virq_chip *vc,
 		void *dev, unsigned long flags)
 {
@@ -553,6 +609,8 @@ static int vgicv2_init_virqchip(struct virq_chip *vc,
 		vc->send_virq = gicv2_send_virq;
 		vc->update_virq = gicv2_update_virq;
 		vc->get_virq_state = gicv2_get_virq_state;
+		vc->set_maintenance = gicv2_set_maintenance;
+		vc->get_empty_lrs = gicv2_get_empty_lrs;
 	}
 
 	vc->xlate = gic_xlate_irq;
@@ -631,13 +689,34 @@ static struct virq_chip *vgicv2_virqchip_init(struct vm *vm,
 VIRQCHIP_DECLARE(gic400_virqchip, gicv2_match_table,
 		vgicv2_virqchip_init);
 
+/*
+ * only the LRs which are not empty are saved, the LRs
+ * used by the last vcpu on this pcpu are cleared when
+ * the new vcpu is restored
+ */
+static DEFINE_PER_CPU(uint64_t, gicv2_live_lrs);
+
+static inline uint64_t gicv2_lr_mask(void)
+{
+	if (gicv2_nr_lrs >= 64)
+		return ~0UL;
+
+	return (1UL << gicv2_nr_lrs) - 1;
+}
+
 static void gicv2_state_restore(struct task *task, void *context)
 {
 	int i;
 	struct gicv2_context *c = (struct gicv2_context *)context;
+	unsigned long dirty = get_cpu_var(gicv2_live_lrs) | c->lr_used;
 
-	for (i = 0; i < gicv2_nr_lrs; i++)
-		writel_gich(c->lr[i], GICH_LR + i * 4);
+	for_each_set_bit(i, &dirty, gicv2_nr_lrs) {
+		if (c->lr_used & (1UL << i))
+			writel_gich(c->lr[i], GICH_LR + i * 4);
+		else
+			writel_gich(0, GICH_LR + i * 4);
+	}
+	get_cpu_var(gicv2_live_lrs) = c->lr_used;
 
 	writel_gich(c->apr, GICH_APR);
 	writel_gich(c->vmcr, GICH_VMCR);
@@ -657,12 +736,17 @@ static void gicv2_state_save(struct task *task, void *context)
 {
 	int i;
 	struct gicv2_context *c = (struct gicv2_context *)context;
+	unsigned long used;
 
 	dsb();
 
-	for (i = 0; i < gicv2_nr_lrs; i++)
+	used = ~gicv2_get_empty_lrs(NULL) & gicv2_lr_mask();
+	for_each_set_bit(i, &used, gicv2_nr_lrs)
 		c->lr[i] = readl_gich(GICH_LR + i * 4);
 
+	c->lr_used = used;
+	get_cpu_var(gicv2_live_lrs) = used;
+
 	c->vmcr = readl_gich(GICH_VMCR);
 	c->apr = readl_gich(GICH_APR);
 	c->hcr = readl_gich(GICH_HCR);
@@ -690,6 +774,8 @@ int vgicv2_init(uint64_t *data, int len)
 {
 	int i;
 	uint32_t vtr;
+	unsigned long flags;
+	struct device_node *node;
 	unsigned long *value = (unsigned long *)&vgicv2_info;
 
 	for (i = 0; i < len; i++)
@@ -704,7 +790,25 @@ int vgicv2_init(uint64_t *data, int len)
 	gicv2_nr_lrs = (vtr & 0x3f) + 1;
 	pr_info("vgicv2 vtr 0x%x nr_lrs : 0x%d\n", vtr, gicv2_nr_lrs);
 
+	/* the LRs are not known to be empty when boot */
+	for (i = 0; i < NR_CPUS; i++)
+		get_per_cpu(gicv2_live_lrs, i) = gicv2_lr_mask();
+
+	node = of_find_node_by_compatible(hv_node, gicv2_match_table);
+	if (get_device_irq_index(node, &gicv2_maintenance_irq, &flags, 0))
+		pr_warn("no maintenance irq for vgicv2\n");
+
 	register_task_vmodule("gicv2", gicv2_vmodule_init);
 
 	return 0;
 }
+
+static int vgicv2_maintenance_init(void)
+{
+	if (!gicv2_maintenance_irq)
+		return 0;
+
+	return request_irq(gicv2_maintenance_irq, gicv2_maintenance_handler,
+			0, "vgicv2 maintenance", NULL);
+}
+subsys_initcall_percpu(vgicv2_maintenance_init);
@@ -49,6 +49,7 @@ struct vgicv3_info {
 
 static int gicv3_nr_lr = 0;
 static int gicv3_nr_pr = 0;
+static uint32_t gicv3_maintenance_irq;
 static struct vgicv3_info vgicv3_info;
 
 extern int gic_xlate_irq(struct device_node *node,
@@ -63,7 +64,6 @@ void vgicv3_send_sgi(struct vcpu *vcpu, unsigned long sgi_value)
 	unsigned long tmp, aff3, aff2, aff1;
 	int bit, logic_cpu;
 	struct vm *vm = vcpu->vm;
-	struct vcpu *target;
 
 	sgi = (sgi_value & (0xf << 24)) >> 24;
 	if (sgi >= 16) {
@@ -90,17 +90,14 @@ void vgicv3_send_sgi(struct vcpu *vcpu, unsigned long sgi_value)
 			cpumask_set_cpu(bit, &cpumask);
 		}
 	} else
-		cpumask_set_cpu(smp_processor_id(), &cpumask);
+		cpumask_set_cpu(get_vcpu_id(vcpu), &cpumask);
 
 	/*
 	 * here we update the gicr releated register
 	 * for some other purpose use TBD
 	 */
 
-	for_each_cpu(bit, &cpumask) {
-		target = get_vcpu_in_vm(vm, bit);
-		send_virq_to_vcpu(target, sgi);
-	}
+	send_vsgi(vcpu, sgi, &cpumask);
 }
 
 static int address_to_gicr(struct vgic_gicr *gicr,
@@ -162,6 +159,26 @@ static void vgic_set_virq_type(struct vcpu *vcpu,
 	}
 }
 
+/*
+ * the mpidr of the vcpu is its vcpu id, so the affinity
+ * of the vcpu is the same as the logic cpu, the 1 of N
+ * routing is not supported, the current target is kept
+ */
+static void vgic_set_virq_affinity(struct vcpu *vcpu,
+		unsigned long offset, unsigned long value)
+{
+	int target;
+	uint32_t virq = (offset - GICD_IROUTER) / 8;
+
+	if (value & GICD_IROUTER_MODE_ANY)
+		return;
+
+	target = affinity_to_logic_cpu((value >> 32) & 0xff,
+			(value >> 16) & 0xff, (value >> 8) & 0xff,
+			value & 0xff);
+	virq_set_affinity(vcpu, virq, target);
+}
+
 static int vgic_gicd_mmio_read(struct vcpu *vcpu,
 			struct vgic_gicd *gicd,
 			unsigned long offset,
@@ -191,6 +208,14 @@ static int vgic_gicd_mmio_read(struct vcpu *vcpu,
 		case GICD_ICFGR...GICD_ICFGR_END:
 			*value = vgic_get_virq_type(vcpu, offset);
 			break;
+		case GICD_IROUTER...GICD_IROUTER_END:
+			/* for aarch32 the high word is the aff3 */
+			if (offset & 0x4)
+				*v = 0;
+			else
+				*v = virq_get_affinity(vcpu,
+					(offset - GICD_IROUTER) / 8);
+			break;
 		default:
 			*value = 0;
 			break;
@@ -245,6 +270,10 @@ static int vgic_gicd_mmio_write(struct vcpu *vcpu,
 	case GICD_ICFGR...GICD_ICFGR_END:
 		vgic_set_virq_type(vcpu, offset, *value);
 		break;
+	case GICD_IROUTER...GICD_IROUTER_END:
+		if (!(offset & 0x4))
+			vgic_set_virq_affinity(vcpu, offset, *value);
+		break;
 
 	default:
 		break;
@@ -263,11 +292,25 @@ static int vgic_gicd_mmio(struct vcpu *vcpu, struct vgic_gicd *gicd,
 		return vgic_gicd_mmio_write(vcpu, gicd, offset, value);
 }
 
-static int vgic_gicr_rd_mmio(struct vcpu *vcpu, struct vgic_gicr *gicr,
-		int read, unsigned long offset, unsigned long *value)
+static void vgic_gicr_write_baser(uint64_t *baser,
+		unsigned long offset, unsigned long value)
+{
+	/* for aarch32 assume the high word is written by 32bit */
+	if (offset & 0x4)
+		*baser = (*baser & 0xffffffff) | ((uint64_t)value << 32);
+	else
+		*baser = value;
+}
+
+static int vgic_gicr_rd_mmio(struct vcpu *vcpu, struct vgicv3_dev *gic,
+		struct vgic_gicr *gicr, int read,
+		unsigned long offset, unsigned long *value)
 {
 	if (read) {
 		switch (offset) {
+		case GICR_CTLR:
+			*value = gicr->gicr_ctlr & GICR_CTLR_ENABLE_LPIS;
+			break;
 		case GICR_PIDR2:
 			*value = gicr->gicr_pidr2;
 			break;
@@ -277,12 +320,57 @@ static int vgic_gicr_rd_mmio(struct vcpu *vcpu, struct vgic_gicr *gicr,
 		case GICR_TYPER_HIGH:
 			*value = gicr->gicr_typer >> 32;	/* for aarch32 assume 32bit read */
 			break;
+		case GICR_PROPBASER:
+			*value = gicr->gicr_propbaser;
+			break;
+		case GICR_PROPBASER + 4:
+			*value = gicr->gicr_propbaser >> 32;
+			break;
+		case GICR_PENDBASER:
+			*value = gicr->gicr_pendbaser;
+			break;
+		case GICR_PENDBASER + 4:
+			*value = gicr->gicr_pendbaser >> 32;
+			break;
 		default:
 			*value = 0;
 			break;
 		}
-	} else {
 
+		return 0;
+	}
+
+	/* the lpi registers are RAZ/WI if the vm has no its */
+	if (!gic->its)
+		return 0;
+
+	switch (offset) {
+	case GICR_CTLR:
+		/* the enable of the lpis can not be cleared once set */
+		if (*value & GICR_CTLR_ENABLE_LPIS)
+			gicr->gicr_ctlr |= GICR_CTLR_ENABLE_LPIS;
+		break;
+	case GICR_PROPBASER:
+	case GICR_PROPBASER + 4:
+		if (gicr->gicr_ctlr & GICR_CTLR_ENABLE_LPIS)
+			break;
+		vgic_gicr_write_baser(&gicr->gicr_propbaser, offset, *value);
+		vgic_its_set_propbaser(gic->its, gicr->gicr_propbaser);
+		break;
+	case GICR_PENDBASER:
+	case GICR_PENDBASER + 4:
+		if (gicr->gicr_ctlr & GICR_CTLR_ENABLE_LPIS)
+			break;
+		vgic_gicr_write_baser(&gicr->gicr_pendbaser, offset, *value);
+		break;
+	case GICR_INVLPIR:
+		vgic_its_inv_lpi(gic->its, (uint32_t)*value);
+		break;
+	case GICR_INVALLR:
+		vgic_its_invall(gic->its);
+		break;
+	default:
+		break;
 	}
 
 	return 0;
@@ -425,7 +513,7 @@ out:
 	case GIC_TYPE_GICD:
 		return vgic_gicd_mmio(vcpu, gicd, read, offset, value);
 	case GIC_TYPE_GICR_RD:
-		return vgic_gicr_rd_mmio(vcpu, gicr, read, offset, value);
+		return vgic_gicr_rd_mmio(vcpu, gic, gicr, read, offset, value);
 	case GIC_TYPE_GICR_SGI:
 		return vgic_gicr_sgi_mmio(vcpu, gicr, read, offset, value);
 	case GIC_TYPE_GICR_VLPI:
@@ -497,8 +585,13 @@ static void vgic_gicr_init(struct vcpu *vcpu,
 	gicr->gicr_ispender = 0;
 	spin_lock_init(&gicr->gicr_lock);
 
-	/* TBD */
-	gicr->gicr_typer = 0 | ((unsigned long)vcpu->vcpu_id << 32);
+	/*
+	 * the processor number is used as the target of the
+	 * collections in the its commands, since GITS_TYPER.PTA
+	 * is zero
+	 */
+	gicr->gicr_typer = ((unsigned long)vcpu->vcpu_id << 32) |
+			(vcpu->vcpu_id << 8);
 	gicr->gicr_pidr2 = 0x3 << 4;
 }
 
@@ -613,8 +706,6 @@ static void gicv3_write_lr(int lr, uint64_t val)
 	default:
 		return;
 	}
-
-	isb();
 }
 
 static int gicv3_send_virq(struct vcpu *vcpu, struct virq_desc *virq)
@@ -634,6 +725,7 @@ static int gicv3_send_virq(struct vcpu *vcpu, struct virq_desc *virq)
 	lr->hw = !!virq_is_hw(virq);
 	lr->state = 1;
 
+	/* the eret to guest will synchronize the LR */
 	gicv3_write_lr(virq->id, value);
 
 	return 0;
@@ -661,6 +753,7 @@ static int gicv3_update_virq(struct vcpu *vcpu,
 
 	case VIRQ_ACTION_CLEAR:
 		gicv3_write_lr(desc->id, 0);
+		isb();
 		break;
 
 	default:
@@ -684,6 +777,40 @@ static int gicv3_get_virq_state(struct vcpu *vcpu, struct virq_desc *virq)
 	return ((int)value);
 }
 
+static uint64_t gicv3_get_empty_lrs(struct vcpu *vcpu)
+{
+	return read_sysreg32(ICH_ELRSR_EL2);
+}
+
+static int gicv3_set_maintenance(struct vcpu *vcpu, int enable)
+{
+	uint32_t value;
+
+	value = read_sysreg32(ICH_HCR_EL2);
+	if (enable == !!(value & GICH_HCR_UIE))
+		return 0;
+
+	if (enable)
+		value |= GICH_HCR_UIE;
+	else
+		value &= ~GICH_HCR_UIE;
+
+	write_sysreg32(value, ICH_HCR_EL2);
+	isb();
+
+	return 0;
+}
+
+static int gicv3_maintenance_handler(uint32_t irq, void *data)
+{
+	/*
+	 * the LRs have been updated when exit from guest
+	 * disable the underflow irq here, the remaining
+	 * virqs will be injected when enter to guest
+	 */
+	return gicv3_set_maintenance(NULL, 0);
+}
+
 static void vgicv3_init_virqchip(struct virq_chip *vc,
 		struct vgicv3_dev *dev, unsigned long flags)
 {
@@ -695,6 +822,8 @@ static void vgicv3_init_virqchip(struct virq_chip *vc,
 		vc->send_virq = gicv3_send_virq;
 		vc->update_virq = gicv3_update_virq;
 		vc->get_virq_state = gicv3_get_virq_state;
+		vc->set_maintenance = gicv3_set_maintenance;
+		vc->get_empty_lrs = gicv3_get_empty_lrs;
 		vc->vm0_virq_data = gic_vm0_virq_data;
 		vc->flags = flags;
 	} else {
@@ -703,6 +832,81 @@ static void vgicv3_init_virqchip(struct virq_chip *vc,
 	}
 }
 
+static int vgicv3_send_msi(struct vm *vm, uint32_t devid, uint32_t eventid)
+{
+	struct vgicv3_dev *dev = vm->virq_chip->inc_pdata;
+
+	if (!dev->its)
+		return -ENOENT;
+
+	return vgic_its_send_msi(dev->its, devid, eventid);
+}
+
+static inline int vgic_range_overlap(unsigned long base, size_t size,
+		unsigned long start, unsigned long end)
+{
+	return ((base < end) && (base + size > start));
+}
+
+/*
+ * the vdev of the vgicv3 covers GICD to the end of GICR, the
+ * its may sit in the hole between them, but must not overlap
+ * the frames which the vgicv3 really emulates
+ */
+static int vgicv3_its_range_valid(struct vm *vm, struct vgicv3_dev *dev,
+		unsigned long base, size_t size)
+{
+	int i;
+	struct vgic_gicr *gicr;
+
+	if (vgic_range_overlap(base, size, dev->gicd.base, dev->gicd.end))
+		return 0;
+
+	for (i = 0; i < vm->vcpu_nr; i++) {
+		gicr = dev->gicr[i];
+		if (vgic_range_overlap(base, size, gicr->rd_base,
+				gicr->sgi_base + SIZE_64K))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * called when the virtual its of the vm is created, the lpis
+ * are advertised by the gicd and the gicrs only after that
+ */
+int vgicv3_attach_its(struct vm *vm, struct vgic_its *its,
+		unsigned long base, size_t size)
+{
+	int i, idbits;
+	struct vgicv3_dev *dev;
+	struct virq_chip *vc = vm->virq_chip;
+
+	if (!vc || (vc->send_virq != gicv3_send_virq))
+		return -ENOENT;
+
+	dev = vc->inc_pdata;
+	if (dev->its)
+		return -EEXIST;
+
+	if (!vgicv3_its_range_valid(vm, dev, base, size))
+		return -EINVAL;
+
+	dev->its = its;
+	vc->send_msi = vgicv3_send_msi;
+
+	/* the intid bits need to cover all the lpis of the vm */
+	idbits = fls(VM_LPI_VIRQ_BASE + VM_LPI_VIRQ_NR - 1);
+	dev->gicd.gicd_typer &= ~(0x1f << 19);
+	dev->gicd.gicd_typer |= ((idbits - 1) << 19) | GICD_TYPER_LPIS;
+
+	for (i = 0; i < vm->vcpu_nr; i++)
+		dev->gicr[i]->gicr_typer |= GICR_TYPER_PLPIS;
+
+	return 0;
+}
+
 struct virq_chip *vgicv3_virqchip_init(struct vm *vm,
 		struct device_node *node)
 {
@@ -758,6 +962,7 @@ struct virq_chip *vgicv3_virqchip_init(struct vm *vm,
 	if (vgicv3_info.gicd_base != 0)
 		flags |= VIRQCHIP_F_HW_VIRT;
 
+	vc->inc_pdata = vgicv3_dev;
 	vgicv3_init_virqchip(vc, vgicv3_dev, flags);
 
 	return vc;
@@ -768,48 +973,32 @@ release_gic:
 }
 VIRQCHIP_DECLARE(vgicv3_chip, gicv3_match_table, vgicv3_virqchip_init);
 
-static void gicv3_save_lrs(struct gicv3_context *c, uint32_t count)
+/*
+ * only the LRs which are not empty are saved, and the
+ * mask of them is kept in the context, the LRs which are
+ * used by the last vcpu on this pcpu are cleared when
+ * the new vcpu is restored
+ */
+static DEFINE_PER_CPU(uint32_t, gicv3_live_lrs);
+
+static inline uint32_t gicv3_lr_mask(void)
 {
-	if (count > 16)
-		panic("Unsupport LR count\n");
+	return (1U << gicv3_nr_lr) - 1;
+}
 
-	switch (count) {
-	case 16:
-		c->ich_lr15_el2 = read_sysreg(ICH_LR15_EL2);
-	case 15:
-		c->ich_lr14_el2 = read_sysreg(ICH_LR14_EL2);
-	case 14:
-		c->ich_lr13_el2 = read_sysreg(ICH_LR13_EL2);
-	case 13:
-		c->ich_lr12_el2 = read_sysreg(ICH_LR12_EL2);
-	case 12:
-		c->ich_lr11_el2 = read_sysreg(ICH_LR11_EL2);
-	case 11:
-		c->ich_lr10_el2 = read_sysreg(ICH_LR10_EL2);
-	case 10:
-		c->ich_lr9_el2 = read_sysreg(ICH_LR9_EL2);
-	case 9:
-		c->ich_lr8_el2 = read_sysreg(ICH_LR8_EL2);
-	case 8:
-		c->ich_lr7_el2 = read_sysreg(ICH_LR7_EL2);
-	case 7:
-		c->ich_lr6_el2 = read_sysreg(ICH_LR6_EL2);
-	case 6:
-		c->ich_lr5_el2 = read_sysreg(ICH_LR5_EL2);
-	case 5:
-		c->ich_lr4_el2 = read_sysreg(ICH_LR4_EL2);
-	case 4:
-		c->ich_lr3_el2 = read_sysreg(ICH_LR3_EL2);
-	case 3:
-		c->ich_lr2_el2 = read_sysreg(ICH_LR2_EL2);
-	case 2:
-		c->ich_lr1_el2 = read_sysreg(ICH_LR1_EL2);
-	case 1:
-		c->ich_lr0_el2 = read_sysreg(ICH_LR0_EL2);
-		break;
-	default:
-		break;
-	}
+static void gicv3_save_lrs(struct gicv3_context *c)
+{
+	int i;
+	uint64_t *lrs = &c->ich_lr0_el2;
+	unsigned long used;
+
+	isb();
+	used = ~read_sysreg32(ICH_ELRSR_EL2) & gicv3_lr_mask();
+	for_each_set_bit(i, &used, gicv3_nr_lr)
+		lrs[i] = gicv3_read_lr(i);
+
+	c->lr_used = used;
+	get_cpu_var(gicv3_live_lrs) = used;
 }
 
 static void gicv3_save_aprn(struct gicv3_context *c, uint32_t count)
@@ -835,7 +1024,7 @@ static void gicv3_state_save(struct task *task, void *context)
 	struct gicv3_context *c = (struct gicv3_context *)context;
 
 	dsb();
-	gicv3_save_lrs(c, gicv3_nr_lr);
+	gicv3_save_lrs(c);
 	gicv3_save_aprn(c, gicv3_nr_pr);
 	c->icc_sre_el1 = read_sysreg32(ICC_SRE_EL1);
 	c->ich_vmcr_el2 = read_sysreg32(ICH_VMCR_EL2);
@@ -860,55 +1049,27 @@ static void gicv3_restore_aprn(struct gicv3_context *c, uint32_t count)
 	}
 }
 
-static void gicv3_restore_lrs(struct gicv3_context *c, uint32_t count)
+static void gicv3_restore_lrs(struct gicv3_context *c)
 {
-	if (count > 16)
-		panic("Unsupport LR count");
-
-	switch (count) {
-	case 16:
-		write_sysreg(c->ich_lr15_el2, ICH_LR15_EL2);
-	case 15:
-		write_sysreg(c->ich_lr14_el2, ICH_LR14_EL2);
-	case 14:
-		write_sysreg(c->ich_lr13_el2, ICH_LR13_EL2);
-	case 13:
-		write_sysreg(c->ich_lr12_el2, ICH_LR12_EL2);
-	case 12:
-		write_sysreg(c->ich_lr11_el2, ICH_LR11_EL2);
-	case 11:
-		write_sysreg(c->ich_lr10_el2, ICH_LR10_EL2);
-	case 10:
-		write_sysreg(c->ich_lr9_el2, ICH_LR9_EL2);
-	case 9:
-		write_sysreg(c->ich_lr8_el2, ICH_LR8_EL2);
-	case 8:
-		write_sysreg(c->ich_lr7_el2, ICH_LR7_EL2);
-	case 7:
-		write_sysreg(c->ich_lr6_el2, ICH_LR6_EL2);
-	case 6:
-		write_sysreg(c->ich_lr5_el2, ICH_LR5_EL2);
-	case 5:
-		write_sysreg(c->ich_lr4_el2, ICH_LR4_EL2);
-	case 4:
-		write_sysreg(c->ich_lr3_el2, ICH_LR3_EL2);
-	case 3:
-		write_sysreg(c->ich_lr2_el2, ICH_LR2_EL2);
-	case 2:
-		write_sysreg(c->ich_lr1_el2, ICH_LR1_EL2);
-	case 1:
-		write_sysreg(c->ich_lr0_el2, ICH_LR0_EL2);
-		break;
-	default:
-		break;
+	int i;
+	uint64_t *lrs = &c->ich_lr0_el2;
+	unsigned long dirty = get_cpu_var(gicv3_live_lrs) | c->lr_used;
+
+	for_each_set_bit(i, &dirty, gicv3_nr_lr) {
+		if (c->lr_used & (1U << i))
+			gicv3_write_lr(i, lrs[i]);
+		else
+			gicv3_write_lr(i, 0);
 	}
+
+	get_cpu_var(gicv3_live_lrs) = c->lr_used;
 }
 
 static void gicv3_state_restore(struct task *task, void *context)
 {
 	struct gicv3_context *c = (struct gicv3_context *)context;
 
-	gicv3_restore_lrs(c, gicv3_nr_lr);
+	gicv3_restore_lrs(c);
 	gicv3_restore_aprn(c, gicv3_nr_pr);
 	write_sysreg32(c->icc_sre_el1, ICC_SRE_EL1);
 	write_sysreg32(c->ich_vmcr_el2, ICH_VMCR_EL2);
@@ -946,6 +1107,8 @@ int vgicv3_init(uint64_t *data, int len)
 {
 	int i;
 	uint32_t val;
+	unsigned long flags;
+	struct device_node *node;
 	unsigned long *value = (unsigned long *)&vgicv3_info;
 
 	for (i = 0; i < len; i++)
@@ -958,8 +1121,28 @@ int vgicv3_init(uint64_t *data, int len)
 	val = read_sysreg32(ICH_VTR_EL2);
 	gicv3_nr_lr = (val & 0x3f) + 1;
 	gicv3_nr_pr = ((val >> 29) & 0x7) + 1;
+	if (gicv3_nr_lr > 16)
+		panic("Unsupport LR count\n");
+
+	/* the LRs are not known to be empty when boot */
+	for (i = 0; i < NR_CPUS; i++)
+		get_per_cpu(gicv3_live_lrs, i) = gicv3_lr_mask();
+
+	node = of_find_node_by_compatible(hv_node, gicv3_match_table);
+	if (get_device_irq_index(node, &gicv3_maintenance_irq, &flags, 0))
+		pr_warn("no maintenance irq for vgicv3\n");
 
 	register_task_vmodule("gicv3-vmodule", gicv3_vmodule_init);
 
 	return 0;
 }
+
+static int vgicv3_maintenance_init(void)
+{
+	if (!gicv3_maintenance_irq)
+		return 0;
+
+	return request_irq(gicv3_maintenance_irq, gicv3_maintenance_handler,
+			0, "vgicv3 maintenance", NULL);
+}
+subsys_initcall_percpu(vgicv3_maintenance_init);
@@ -0,0 +1,779 @@
+/*
+ * Copyright (C) 2018 Min Le (lemin9538@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <minos/minos.h>
+#include <asm/arch.h>
+#include <asm/gicv3.h>
+#include <asm/vgicv3.h>
+#include <minos/sched.h>
+#include <minos/of.h>
+#include <virt/vm.h>
+#include <virt/vmm.h>
+#include <virt/virq.h>
+#include <virt/vdev.h>
+#include <virt/virq_chip.h>
+
+/*
+ * the virtual its only provides the physical lpis, the
+ * device, collection and itt tables are kept inside the
+ * hypervisor, so all the GITS_BASERn are RAZ/WI, the
+ * command queue and the lpi property table are read from
+ * the guest memory when the guest asks for it
+ */
+#define GITS_CMD_MOVI		(0x01)
+#define GITS_CMD_INT		(0x03)
+#define GITS_CMD_CLEAR		(0x04)
+#define GITS_CMD_SYNC		(0x05)
+#define GITS_CMD_MAPD		(0x08)
+#define GITS_CMD_MAPC		(0x09)
+#define GITS_CMD_MAPTI		(0x0a)
+#define GITS_CMD_MAPI		(0x0b)
+#define GITS_CMD_INV		(0x0c)
+#define GITS_CMD_INVALL		(0x0d)
+#define GITS_CMD_MOVALL		(0x0e)
+#define GITS_CMD_DISCARD	(0x0f)
+
+#define VITS_IOMEM_SIZE		(0x20000)
+#define VITS_CMD_SIZE		(32)
+#define VITS_CMD_BATCH		(8)
+#define VITS_PROP_BATCH		(64)
+#define VITS_DEVID_BITS		(16)
+#define VITS_EVENTID_BITS	(16)
+#define VITS_NR_COLLECTIONS	(NR_CPUS)
+#define VITS_INVALID_TARGET	(0xffff)
+#define VITS_ADDR_MASK		(0x000ffffffffff000UL)
+
+#define GITS_CREADR_STALLED	(1 << 0)
+#define GITS_CWRITER_RETRY	(1 << 0)
+
+#define LPI_PROP_ENABLED	(1 << 0)
+#define LPI_PROP_PRIORITY(p)	((p) & 0xfc)
+
+#define vdev_to_its(vdev) \
+	(struct vgic_its *)container_of(vdev, struct vgic_its, vdev)
+
+struct vits_ite {
+	uint32_t eventid;
+	uint32_t lpi;
+	uint16_t icid;
+	struct list_head list;
+};
+
+struct vits_device {
+	uint32_t devid;
+	uint32_t nr_events;
+	struct list_head ite_list;
+	struct list_head list;
+};
+
+struct vgic_its {
+	struct vdev vdev;
+	struct vm *vm;
+	spinlock_t lock;
+	uint32_t ctlr;
+	uint64_t cbaser;
+	uint64_t cwriter;
+	uint64_t creadr;
+	uint64_t propbaser;
+	int stalled;
+	int processing;
+	int invall;
+	struct list_head device_list;
+	uint16_t col_target[VITS_NR_COLLECTIONS];
+
+	/*
+	 * the ite which the lpi is mapped to, and the lpis
+	 * which are triggered when they are disabled by the
+	 * guest, they are sent when the guest enables them
+	 */
+	struct vits_ite *lpi_ite[VM_LPI_VIRQ_NR];
+	DECLARE_BITMAP(lpi_latch, VM_LPI_VIRQ_NR);
+
+	/* the lpis whose property need to be read again */
+	DECLARE_BITMAP(lpi_inv, VM_LPI_VIRQ_NR);
+
+	unsigned long nr_cmds;
+	unsigned long nr_msis;
+};
+
+static inline int vits_lpi_index(struct vgic_its *its, uint32_t lpi)
+{
+	if (!VIRQ_IS_LPI(lpi) || (lpi - VM_LPI_VIRQ_BASE >= its->vm->vlpi_nr))
+		return -1;
+
+	return lpi - VM_LPI_VIRQ_BASE;
+}
+
+static struct vits_device *vits_find_device(struct vgic_its *its,
+		uint32_t devid)
+{
+	struct vits_device *dev;
+
+	list_for_each_entry(dev, &its->device_list, list) {
+		if (dev->devid == devid)
+			return dev;
+	}
+
+	return NULL;
+}
+
+static struct vits_ite *vits_find_ite(struct vgic_its *its,
+		uint32_t devid, uint32_t eventid)
+{
+	struct vits_ite *ite;
+	struct vits_device *dev;
+
+	dev = vits_find_device(its, devid);
+	if (!dev)
+		return NULL;
+
+	list_for_each_entry(ite, &dev->ite_list, list) {
+		if (ite->eventid == eventid)
+			return ite;
+	}
+
+	return NULL;
+}
+
+static int vits_deliver(struct vgic_its *its, struct vits_ite *ite)
+{
+	struct vcpu *vcpu;
+	struct virq_desc *desc;
+	uint16_t target = its->col_target[ite->icid];
+	int index = ite->lpi - VM_LPI_VIRQ_BASE;
+
+	if (target == VITS_INVALID_TARGET)
+		return -ENOENT;
+
+	vcpu = get_vcpu_in_vm(its->vm, target);
+	if (!vcpu)
+		return -ENOENT;
+
+	desc = &its->vm->vlpi_desc[index];
+	if (!virq_is_enabled(desc)) {
+		set_bit(index, its->lpi_latch);
+		return 0;
+	}
+
+	desc->vcpu_id = target;
+
+	return send_virq_to_vcpu(vcpu, ite->lpi);
+}
+
+static void vits_free_ite(struct vgic_its *its, struct vits_ite *ite)
+{
+	int index = ite->lpi - VM_LPI_VIRQ_BASE;
+
+	if (its->lpi_ite[index] == ite) {
+		its->lpi_ite[index] = NULL;
+		clear_bit(index, its->lpi_latch);
+	}
+
+	list_del(&ite->list);
+	free(ite);
+}
+
+static void vits_free_device(struct vgic_its *its, struct vits_device *dev)
+{
+	struct vits_ite *ite, *n;
+
+	list_for_each_entry_safe(ite, n, &dev->ite_list, list)
+		vits_free_ite(its, ite);
+
+	list_del(&dev->list);
+	free(dev);
+}
+
+static void vits_update_lpi(struct vgic_its *its, int index, uint8_t prop)
+{
+	struct virq_desc *desc = &its->vm->vlpi_desc[index];
+
+	desc->pr = LPI_PROP_PRIORITY(prop);
+	if (!(prop & LPI_PROP_ENABLED)) {
+		virq_clear_enable(desc);
+		return;
+	}
+
+	virq_set_enable(desc);
+
+	if (test_and_clear_bit(index, its->lpi_latch) && its->lpi_ite[index])
+		vits_deliver(its, its->lpi_ite[index]);
+}
+
+/*
+ * read the configuration of the lpis from the property
+ * table of the guest, the table is indexed from intid 8192
+ */
+static int vits_read_props(struct vgic_its *its, int index,
+		uint8_t *props, int nr)
+{
+	unsigned long base = its->propbaser & VITS_ADDR_MASK;
+	int idbits = (its->propbaser & 0x1f) + 1;
+
+	if (!base || (VM_LPI_VIRQ_BASE + index + nr > (1UL << idbits)))
+		return -EINVAL;
+
+	return copy_from_vm_ipa(its->vm, props, base + index, nr);
+}
+
+static int vits_inv_lpi(struct vgic_its *its, uint32_t lpi)
+{
+	int index = vits_lpi_index(its, lpi);
+
+	if (index < 0)
+		return -EINVAL;
+
+	set_bit(index, its->lpi_inv);
+
+	return 0;
+}
+
+/*
+ * the lpis marked by INV and INVALL are updated here, the
+ * property table is read from the guest memory without
+ * the lock held, then the lpis are updated with the lock
+ */
+static void vits_sync_props(struct vgic_its *its, int all)
+{
+	uint8_t props[VITS_PROP_BATCH];
+	unsigned long flags;
+	int i, j, nr, ret;
+
+	for (i = 0; i < its->vm->vlpi_nr; i += VITS_PROP_BATCH) {
+		nr = its->vm->vlpi_nr - i;
+		if (nr > VITS_PROP_BATCH)
+			nr = VITS_PROP_BATCH;
+
+		if (!all && (find_next_bit(its->lpi_inv, i + nr, i) >= i + nr))
+			continue;
+
+		/* the table may be smaller than the lpis of the vm */
+		ret = vits_read_props(its, i, props, nr);
+
+		spin_lock_irqsave(&its->lock, flags);
+		for (j = 0; j < nr; j++) {
+			if (!test_and_clear_bit(i + j, its->lpi_inv) && !all)
+				continue;
+			if (!ret)
+				vits_update_lpi(its, i + j, props[j]);
+		}
+		spin_unlock_irqrestore(&its->lock, flags);
+	}
+}
+
+static int vits_cmd_mapd(struct vgic_its *its, uint32_t devid,
+		int size, int valid)
+{
+	struct vits_device *dev;
+
+	if (devid >= (1UL << VITS_DEVID_BITS))
+		return -EINVAL;
+
+	/* remap the device will drop all its old mappings */
+	dev = vits_find_device(its, devid);
+	if (dev)
+		vits_free_device(its, dev);
+
+	if (!valid)
+		return 0;
+
+	if (size > VITS_EVENTID_BITS)
+		return -EINVAL;
+
+	dev = zalloc(sizeof(struct vits_device));
+	if (!dev)
+		return -ENOMEM;
+
+	dev->devid = devid;
+	dev->nr_events = 1 << size;
+	init_list(&dev->ite_list);
+	list_add_tail(&its->device_list, &dev->list);
+
+	return 0;
+}
+
+static int vits_cmd_mapc(struct vgic_its *its, uint32_t icid,
+		unsigned long target, int valid)
+{
+	if (icid >= VITS_NR_COLLECTIONS)
+		return -EINVAL;
+
+	if (!valid) {
+		its->col_target[icid] = VITS_INVALID_TARGET;
+		return 0;
+	}
+
+	if (target >= its->vm->vcpu_nr)
+		return -EINVAL;
+
+	its->col_target[icid] = target;
+
+	return 0;
+}
+
+static int vits_cmd_mapti(struct vgic_its *its, uint32_t devid,
+		uint32_t eventid, uint32_t lpi, uint32_t icid)
+{
+	int index;
+	struct vits_ite *ite;
+	struct vits_device *dev;
+
+	dev = vits_find_device(its, devid);
+	if (!dev || (eventid >= dev->nr_events))
+		return -ENOENT;
+
+	index = vits_lpi_index(its, lpi);
+	if ((index < 0) || (icid >= VITS_NR_COLLECTIONS))
+		return -EINVAL;
+
+	ite = vits_find_ite(its, devid, eventid);
+	if (ite)
+		vits_free_ite(its, ite);
+
+	ite = zalloc(sizeof(struct vits_ite));
+	if (!ite)
+		return -ENOMEM;
+
+	ite->eventid = eventid;
+	ite->lpi = lpi;
+	ite->icid = icid;
+	list_add_tail(&dev->ite_list, &ite->list);
+	its->lpi_ite[index] = ite;
+
+	return 0;
+}
+
+static int vits_handle_cmd(struct vgic_its *its, uint64_t *cmd)
+{
+	struct vits_ite *ite = NULL;
+	uint32_t devid = cmd[0] >> 32;
+	uint32_t eventid = cmd[1] & 0xffffffff;
+	uint32_t icid = cmd[2] & 0xffff;
+	int type = cmd[0] & 0xff;
+
+	switch (type) {
+	case GITS_CMD_MAPD:
+		return vits_cmd_mapd(its, devid,
+				(cmd[1] & 0x1f) + 1, cmd[2] >> 63);
+	case GITS_CMD_MAPC:
+		return vits_cmd_mapc(its, icid,
+				(cmd[2] >> 16) & 0xfffffffffUL, cmd[2] >> 63);
+	case GITS_CMD_MAPTI:
+		return vits_cmd_mapti(its, devid, eventid,
+				cmd[1] >> 32, icid);
+	case GITS_CMD_MAPI:
+		return vits_cmd_mapti(its, devid, eventid, eventid, icid);
+	case GITS_CMD_INVALL:
+		its->invall = 1;
+		return 0;
+	case GITS_CMD_SYNC:
+	case GITS_CMD_MOVALL:
+		/* the lpis are delivered to the vcpu synchronously */
+		return 0;
+	case GITS_CMD_MOVI:
+	case GITS_CMD_DISCARD:
+	case GITS_CMD_INT:
+	case GITS_CMD_CLEAR:
+	case GITS_CMD_INV:
+		ite = vits_find_ite(its, devid, eventid);
+		if (!ite)
+			return -ENOENT;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	switch (type) {
+	case GITS_CMD_MOVI:
+		if (icid >= VITS_NR_COLLECTIONS)
+			return -EINVAL;
+		ite->icid = icid;
+		break;
+	case GITS_CMD_DISCARD:
+		vits_free_ite(its, ite);
+		break;
+	case GITS_CMD_INT:
+		return vits_deliver(its, ite);
+	case GITS_CMD_CLEAR:
+		clear_bit(ite->lpi - VM_LPI_VIRQ_BASE, its->lpi_latch);
+		break;
+	case GITS_CMD_INV:
+		return vits_inv_lpi(its, ite->lpi);
+	}
+
+	return 0;
+}
+
+/*
+ * the commands between CREADR and CWRITER are handled by
+ * batch, the range of a batch is taken with the lock held,
+ * then the commands are copied out of the guest memory
+ * without the lock and handled with the lock again. only
+ * one cpu processes the queue at the same time, the cpu
+ * which moves CWRITER when the queue is being processed
+ * just returns, the new commands will be seen by the
+ * processing cpu
+ */
+static void vits_process_cmds(struct vgic_its *its)
+{
+	uint64_t cmds[VITS_CMD_BATCH * 4];
+	unsigned long base, size, end, creadr, flags;
+	int i, nr, ret, all;
+
+	spin_lock_irqsave(&its->lock, flags);
+	if (its->processing) {
+		spin_unlock_irqrestore(&its->lock, flags);
+		return;
+	}
+
+	its->processing = 1;
+
+	while (1) {
+		if (its->stalled || !(its->ctlr & GITS_CTLR_ENABLED) ||
+				!(its->cbaser & GITS_CBASER_VALID))
+			break;
+
+		base = its->cbaser & VITS_ADDR_MASK;
+		size = ((its->cbaser & 0xff) + 1) * SIZE_4K;
+		creadr = its->creadr;
+		if ((its->cwriter >= size) || (creadr == its->cwriter))
+			break;
+
+		end = (its->cwriter > creadr) ? its->cwriter : size;
+		nr = (end - creadr) / VITS_CMD_SIZE;
+		if (nr > VITS_CMD_BATCH)
+			nr = VITS_CMD_BATCH;
+		spin_unlock_irqrestore(&its->lock, flags);
+
+		ret = copy_from_vm_ipa(its->vm, cmds, base + creadr,
+				nr * VITS_CMD_SIZE);
+
+		spin_lock_irqsave(&its->lock, flags);
+
+		/*
+		 * the queue can not be read, stall the its until
+		 * the guest writes CWRITER with the retry bit
+		 */
+		if (ret) {
+			pr_err("vits: can not read cmd queue at 0x%p\n",
+					base + creadr);
+			its->stalled = 1;
+			break;
+		}
+
+		/* the queue is reset when the lock is released */
+		if ((its->creadr != creadr) ||
+				(its->cbaser & VITS_ADDR_MASK) != base)
+			continue;
+
+		for (i = 0; i < nr; i++) {
+			if (vits_handle_cmd(its, &cmds[i * 4]))
+				pr_warn("vits: cmd 0x%x failed\n",
+						(uint32_t)cmds[i * 4] & 0xff);
+		}
+
+		its->nr_cmds += nr;
+		all = its->invall;
+		its->invall = 0;
+		spin_unlock_irqrestore(&its->lock, flags);
+
+		/*
+		 * the lpis are updated before CREADR moves, so the
+		 * guest sees the INV done once it passes the SYNC
+		 */
+		vits_sync_props(its, all);
+
+		spin_lock_irqsave(&its->lock, flags);
+		its->creadr = (creadr + nr * VITS_CMD_SIZE) % size;
+	}
+
+	its->processing = 0;
+	spin_unlock_irqrestore(&its->lock, flags);
+}
+
+static void vits_write_reg64(uint64_t *reg,
+		unsigned long offset, unsigned long value)
+{
+	/* for aarch32 assume the high word is written by 32bit */
+	if (offset & 0x4)
+		*reg = (*reg & 0xffffffff) | ((uint64_t)value << 32);
+	else
+		*reg = value;
+}
+
+static int vits_mmio_read(struct vdev *vdev, gp_regs *regs,
+		unsigned long address, unsigned long *value)
+{
+	uint64_t typer;
+	struct vgic_its *its = vdev_to_its(vdev);
+	unsigned long offset = address - vdev->gvm_paddr;
+
+	typer = 1 | (7 << 4) | ((VITS_EVENTID_BITS - 1) << 8) |
+		((VITS_DEVID_BITS - 1) << 13) |
+		((unsigned long)VITS_NR_COLLECTIONS << 24);
+
+	switch (offset) {
+	case GITS_CTLR:
+		*value = its->ctlr | GITS_CTLR_QUIESCENT;
+		break;
+	case GITS_IIDR:
+		*value = 0x43b;
+		break;
+	case GITS_TYPER:
+		*value = typer;
+		break;
+	case GITS_TYPER_HIGH:
+		*value = typer >> 32;
+		break;
+	case GITS_CBASER:
+		*value = its->cbaser;
+		break;
+	case GITS_CBASER_HIGH:
+		*value = its->cbaser >> 32;
+		break;
+	case GITS_CWRITER:
+		*value = its->cwriter;
+		break;
+	case GITS_CREADR:
+		*value = its->creadr | (its->stalled ? GITS_CREADR_STALLED : 0);
+		break;
+	case GITS_PIDR2:
+		*value = 0x3 << 4;
+		break;
+	default:
+		*value = 0;
+		break;
+	}
+
+	return 0;
+}
+
+static int vits_mmio_write(struct vdev *vdev, gp_regs *regs,
+		unsigned long address, unsigned long *value)
+{
+	unsigned long flags;
+	struct vgic_its *its = vdev_to_its(vdev);
+	unsigned long offset = address - vdev->gvm_paddr;
+
+	int process = 0;
+
+	/*
+	 * the device id of a msi comes from the bus, not from
+	 * the data the cpu writes, so a write to GITS_TRANSLATER
+	 * by the guest cpu can not be translated and is ignored,
+	 * the msis of the virtual devices are sent by
+	 * send_msi_to_vm() with their device id
+	 */
+	if (offset == GITS_TRANSLATER) {
+		pr_debug("vits: ignore cpu write to GITS_TRANSLATER\n");
+		return 0;
+	}
+
+	spin_lock_irqsave(&its->lock, flags);
+
+	switch (offset) {
+	case GITS_CTLR:
+		its->ctlr = *value & GITS_CTLR_ENABLED;
+		process = 1;
+		break;
+	case GITS_CBASER:
+	case GITS_CBASER_HIGH:
+		if (its->ctlr & GITS_CTLR_ENABLED)
+			break;
+		vits_write_reg64(&its->cbaser, offset, *value);
+		its->creadr = 0;
+		its->stalled = 0;
+		break;
+	case GITS_CWRITER:
+		its->cwriter = *value & 0xfffe0;
+		if (*value & GITS_CWRITER_RETRY)
+			its->stalled = 0;
+		process = 1;
+		break;
+	default:
+		break;
+	}
+
+	spin_unlock_irqrestore(&its->lock, flags);
+
+	if (process)
+		vits_process_cmds(its);
+
+	return 0;
+}
+
+void vgic_its_set_propbaser(struct vgic_its *its, uint64_t value)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&its->lock, flags);
+	its->propbaser = value;
+	spin_unlock_irqrestore(&its->lock, flags);
+}
+
+void vgic_its_inv_lpi(struct vgic_its *its, uint32_t lpi)
+{
+	int ret;
+	unsigned long flags;
+
+	spin_lock_irqsave(&its->lock, flags);
+	ret = vits_inv_lpi(its, lpi);
+	spin_unlock_irqrestore(&its->lock, flags);
+
+	if (!ret)
+		vits_sync_props(its, 0);
+}
+
+void vgic_its_invall(struct vgic_its *its)
+{
+	vits_sync_props(its, 1);
+}
+
+int vgic_its_send_msi(struct vgic_its *its, uint32_t devid, uint32_t eventid)
+{
+	int ret = -ENOENT;
+	unsigned long flags;
+	struct vits_ite *ite;
+
+	spin_lock_irqsave(&its->lock, flags);
+
+	if (its->ctlr & GITS_CTLR_ENABLED) {
+		ite = vits_find_ite(its, devid, eventid);
+		if (ite) {
+			its->nr_msis++;
+			ret = vits_deliver(its, ite);
+		}
+	}
+
+	spin_unlock_irqrestore(&its->lock, flags);
+
+	return ret;
+}
+
+static void vits_reset_lpis(struct vgic_its *its)
+{
+	int i;
+	struct virq_desc *desc;
+	struct vits_device *dev, *n;
+
+	list_for_each_entry_safe(dev, n, &its->device_list, list)
+		vits_free_device(its, dev);
+
+	for (i = 0; i < VITS_NR_COLLECTIONS; i++)
+		its->col_target[i] = VITS_INVALID_TARGET;
+
+	for (i = 0; i < VM_LPI_VIRQ_NR; i++) {
+		desc = &its->vm->vlpi_desc[i];
+		desc->vno = VM_LPI_VIRQ_BASE + i;
+		desc->vmid = its->vm->vmid;
+		desc->id = VIRQ_INVALID_ID;
+		desc->pr = 0xa0;
+		desc->state = VIRQ_STATE_INACTIVE;
+		desc->flags = 0;
+		desc->list.next = NULL;
+	}
+
+	memset(its->lpi_latch, 0, sizeof(its->lpi_latch));
+	memset(its->lpi_inv, 0, sizeof(its->lpi_inv));
+
+	its->ctlr = 0;
+	its->cbaser = 0;
+	its->cwriter = 0;
+	its->creadr = 0;
+	its->propbaser = 0;
+	its->stalled = 0;
+	its->invall = 0;
+}
+
+static void vits_reset(struct vdev *vdev)
+{
+	unsigned long flags;
+	struct vgic_its *its = vdev_to_its(vdev);
+
+	spin_lock_irqsave(&its->lock, flags);
+	vits_reset_lpis(its);
+	spin_unlock_irqrestore(&its->lock, flags);
+}
+
+static void vits_deinit(struct vdev *vdev)
+{
+	struct vgic_its *its = vdev_to_its(vdev);
+	struct vm *vm = its->vm;
+
+	pr_debug("vits: vm-%d %lu cmds %lu msis\n", vm->vmid,
+			its->nr_cmds, its->nr_msis);
+
+	vits_reset_lpis(its);
+	vm->vlpi_nr = 0;
+	free(vm->vlpi_desc);
+	vm->vlpi_desc = NULL;
+
+	vdev_release(&its->vdev);
+	free(its);
+}
+
+static void *vgic_its_init(struct vm *vm, struct device_node *node)
+{
+	int ret;
+	uint64_t base, size;
+	struct vgic_its *its;
+
+	pr_info("create virtual its for vm-%d\n", vm->vmid);
+
+	ret = translate_device_address(node, &base, &size);
+	if (ret || (size < VITS_IOMEM_SIZE))
+		return NULL;
+
+	its = zalloc(sizeof(struct vgic_its));
+	if (!its)
+		return NULL;
+
+	vm->vlpi_desc = zalloc(sizeof(struct virq_desc) * VM_LPI_VIRQ_NR);
+	if (!vm->vlpi_desc)
+		goto free_its;
+
+	its->vm = vm;
+	spin_lock_init(&its->lock);
+	init_list(&its->device_list);
+	vits_reset_lpis(its);
+
+	ret = vgicv3_attach_its(vm, its, base, size);
+	if (ret) {
+		pr_err("vits: vm-%d can not attach to vgicv3 %d\n",
+				vm->vmid, ret);
+		goto free_desc;
+	}
+
+	/* the lpis can be looked up after the descs are ready */
+	wmb();
+	vm->vlpi_nr = VM_LPI_VIRQ_NR;
+
+	host_vdev_init(vm, &its->vdev, base, size);
+	vdev_set_name(&its->vdev, "vits");
+	its->vdev.read = vits_mmio_read;
+	its->vdev.write = vits_mmio_write;
+	its->vdev.deinit = vits_deinit;
+	its->vdev.reset = vits_reset;
+
+	return its;
+
+free_desc:
+	free(vm->vlpi_desc);
+	vm->vlpi_desc = NULL;
+free_its:
+	free(its);
+	return NULL;
+}
+VDEV_DECLARE(vgic_its, gicv3_its_match_table, vgic_its_init);
@@ -36,6 +36,7 @@ static int virqchip_enter_to_guest(void *item, void *data)
 	 * else inject the virq
 	 */
 	spin_lock_irqsave(&virq_struct->lock, flags);
+	virq_harvest_pending(vcpu);
 
 	if (!(vc->flags & VIRQCHIP_F_HW_VIRT)) {
 		if (is_list_empty(&virq_struct->pending_list) &&
@@ -62,6 +63,7 @@ static int virqchip_exit_from_guest(void *item, void *data)
 
 	if (vc->exit_from_guest) {
 		spin_lock_irqsave(&virq_struct->lock, flags);
+		virq_harvest_pending(vcpu);
 		vc->exit_from_guest(vcpu, vc->inc_pdata);
 		spin_unlock_irqrestore(&virq_struct->lock, flags);
 	}
@@ -107,6 +109,14 @@ int virqchip_get_virq_state(struct vcpu *vcpu, struct virq_desc *virq)
 	return 0;
 }
 
+void virqchip_set_maintenance(struct vcpu *vcpu, int enable)
+{
+	struct virq_chip *vc = vcpu->vm->virq_chip;
+
+	if (vc && vc->set_maintenance)
+		vc->set_maintenance(vcpu, enable);
+}
+
 static int virqchip_init(void)
 {
 	register_hook(virqchip_enter_to_guest,
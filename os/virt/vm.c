@@ -135,6 +135,68 @@ int vm_power_up(int vmid)
 	return 0;
 }
 
+/*
+ * update the weight and the cap of all the vcpus of
+ * the vm, they only take effect on the pcpu which
+ * using the fair sched class
+ */
+int vm_set_sched_param(struct vm *vm, uint32_t weight, uint32_t cap)
+{
+	struct vcpu *vcpu;
+
+	if (!vm)
+		return -ENOENT;
+
+	sched_clamp_param(&weight, &cap);
+	vm->sched_weight = weight;
+	vm->sched_cap = cap;
+
+	if (!vm->vcpus)
+		return 0;
+
+	vm_for_each_vcpu(vm, vcpu)
+		sched_set_task_weight(vcpu->task, weight, cap);
+
+	pr_info("vm-%d sched weight %d cap %d\n", vm->vmid, weight, cap);
+
+	return 0;
+}
+
+/*
+ * pin the vcpu to the pcpu, or let the balancer manage
+ * it again if the cpu is negative
+ */
+int vm_migrate_vcpu(struct vm *vm, uint32_t vcpu_id, int cpu)
+{
+	int ret;
+	struct vcpu *vcpu;
+
+	if (!vm)
+		return -ENOENT;
+
+	if (vm_is_hvm(vm))
+		return -EPERM;
+
+	vcpu = get_vcpu_in_vm(vm, vcpu_id);
+	if (!vcpu)
+		return -ENOENT;
+
+	if (cpu < 0) {
+		vcpu->pinned = 0;
+		return 0;
+	}
+
+	ret = vcpu_migrate(vcpu, cpu);
+	if (ret)
+		return ret;
+
+	vcpu->pinned = 1;
+	pr_info("vm-%d vcpu-%d pinned to pcpu-%d\n",
+			vm->vmid, vcpu_id, cpu);
+
+	return 0;
+}
+
 static int __vm_power_off(struct vm *vm, void *args)
 {
 	int ret = 0;
@@ -230,7 +292,7 @@ int create_guest_vm(struct vmtag *tag)
 
 	vmtag->mmap_base = vm->mm.hvm_mmap_base;
 
-	ret = alloc_vm_memory(vm);
+	ret = alloc_vm_memory(vm, vmtag->prefault_size);
 	if (ret)
 		goto release_vm;
 
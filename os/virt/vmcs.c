@@ -21,10 +21,18 @@
 #include <minos/irq.h>
 #include <virt/vmcs.h>
 
+static inline int vmcs_ring_full(struct vmcs *vmcs)
+{
+	return ((vmcs->host_index - vmcs->guest_index) >= VMCS_NR_ENTRIES);
+}
+
 int __vcpu_trap(uint32_t type, uint32_t reason, unsigned long data,
 		unsigned long *result, int nonblock)
 {
+	int ret;
+	uint64_t index;
 	unsigned long flags;
+	struct vmcs_entry *entry;
 	struct vcpu *vcpu = get_current_vcpu();
 	struct vmcs *vmcs = vcpu->vmcs;
 	struct vm *vm0 = get_vm_by_id(0);
@@ -47,40 +55,68 @@ int __vcpu_trap(uint32_t type, uint32_t reason, unsigned long data,
 	local_irq_enable();
 
 	/*
-	 * wait for the last trap complete, if the gvm
+	 * wait for a free entry in the ring, if the gvm
 	 * has the same affinity pcpu with the vm0, need
 	 * to use sched() in case of dead lock
 	 */
-	while (vmcs->guest_index != vmcs->host_index) {
+	while (1) {
+		local_irq_disable();
+		if (!vmcs_ring_full(vmcs))
+			break;
+		local_irq_enable();
+
 		if (vcpu_affinity(vcpu) < vcpu_affinity(vm0->vcpus[0]))
 			sched();
 		else
 			cpu_relax();
 	}
 
-	vmcs->trap_type = type;
-	vmcs->trap_reason = reason;
-	vmcs->trap_data = data;
-	vmcs->trap_ret = 0;
+	/*
+	 * vm0 can not take the virq, do not publish the
+	 * entry which will never be notified
+	 */
+	if (!vm_can_take_virq(vm0)) {
+		local_irq_restore(flags);
+		return -EFAULT;
+	}
+
+	/*
+	 * the entry is filled with the irq disabled, so
+	 * the trap posted from the irq context will not
+	 * get the same entry
+	 */
+	index = vmcs->host_index;
+	entry = vmcs_entry(vmcs, index);
+	entry->trap_type = type;
+	entry->trap_reason = reason;
+	entry->trap_data = data;
+	entry->trap_ret = 0;
 	if (result)
-		vmcs->trap_result = *result;
+		entry->trap_result = *result;
 	else
-		vmcs->trap_result = 0;
+		entry->trap_result = 0;
 
 	/*
 	 * increase the host index of the vmcs, then send the
 	 * virq to the vcpu0 of the vm0
 	 */
-	vmcs->host_index++;
+	wmb();
+	vmcs->host_index = index + 1;
 	mb();
 
-	if (send_virq_to_vm(vm0, vcpu->vmcs_irq)) {
+	ret = send_virq_to_vm(vm0, vcpu->vmcs_irq);
+	local_irq_enable();
+
+	/*
+	 * the entry is already published and mvm may have
+	 * consumed it, so the host index can not go back,
+	 * the entry will be handled when vm0 gets the next
+	 * virq of this vcpu
+	 */
+	if (ret) {
 		pr_err("vmcs failed to send virq for vm-%d\n",
 				vcpu->vm->vmid);
-		vmcs->host_index--;
-		vmcs->trap_ret = -EPERM;
-		vmcs->trap_result = 0;
-		mb();
+		local_irq_restore(flags);
 		return -EFAULT;
 	}
 
@@ -92,28 +128,32 @@ int __vcpu_trap(uint32_t type, uint32_t reason, unsigned long data,
 		nonblock = 0;
 
 	/*
-	 * if gvm's vcpu is on the same pcpu which hvm
-	 * affnity, then need to call sched to sched the
-	 * hvm's vcpu in case of dead lock
+	 * posted trap return directly, the entry will be
+	 * completed by vm0 later. if gvm's vcpu is on the
+	 * same pcpu which hvm affnity, then need to call
+	 * sched to sched the hvm's vcpu in case of dead lock
 	 */
 	if (!nonblock) {
-		while (vmcs->guest_index != vmcs->host_index) {
+		while (vmcs->guest_index <= index) {
 			if (vcpu_affinity(vcpu) < vm0->vcpu_nr)
 				sched();
 			else
 				cpu_relax();
 		}
 
+		rmb();
 		if (result)
-			*result = vmcs->trap_result;
+			*result = entry->trap_result;
+		ret = entry->trap_ret;
 	} else {
 		if (result)
 			*result = 0;
+		ret = 0;
 	}
 
 	local_irq_restore(flags);
 
-	return vmcs->trap_ret;
+	return ret;
 }
 
 int setup_vmcs_data(void *data, size_t size)
@@ -137,6 +177,7 @@ static void vcpu_vmcs_init(struct vcpu *vcpu)
 	}
 
 	vmcs->vcpu_id = get_vcpu_id(vcpu);
+	vmcs->nr_entries = VMCS_NR_ENTRIES;
 }
 
 unsigned long vm_create_vmcs(struct vm *vm)
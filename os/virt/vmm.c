@@ -123,6 +123,9 @@ void release_vm_memory(struct vm *vm)
 		page = tmp;
 	}
 
+	if (mm->mem_blocks)
+		free(mm->mem_blocks);
+
 	free_pages((void *)mm->pgd_base);
 	memset(mm, 0, sizeof(struct mm_struct));
 }
@@ -240,6 +243,13 @@ int vm_mmap(struct vm *vm, unsigned long offset, unsigned long size)
 
 	attr = page_table_description(VM_DES_BLOCK | VM_NORMAL);
 
+	/*
+	 * the memory blocks which are allocated after this
+	 * will be mapped to vm0 by vm_map_mem_block()
+	 */
+	mm->hvm_mmaped = 1;
+	dsb();
+
 	while (left > 0) {
 		vm_pmd = (unsigned long *)get_mapping_pmd(mm->pgd_base, vir, 0);
 		if (mapping_error(vm_pmd))
@@ -250,9 +260,15 @@ int vm_mmap(struct vm *vm, unsigned long offset, unsigned long size)
 		count = count > left ? left : count;
 
 		for (i = 0; i < count; i++) {
-			value = *(vm_pmd + vir_off);
-			value &= PAGETABLE_ATTR_MASK;
-			value |= attr;
+			/*
+			 * the memory of the vm may be allocated on
+			 * demand, skip the blocks not mapped yet
+			 */
+			value = vm_pmd ? *(vm_pmd + vir_off) : 0;
+			if (value) {
+				value &= PAGETABLE_ATTR_MASK;
+				value |= attr;
+			}
 
 			*(vm0_pmd + phy_off) = value;
 
@@ -291,6 +307,7 @@ void vm_unmmap(struct vm *vm)
 
 	phy = mm->hvm_mmap_base;
 	left = region->size >> PMD_RANGE_OFFSET;
+	mm->hvm_mmaped = 0;
 
 	while (left > 0) {
 		vm0_pmd = (unsigned long *)get_mapping_pmd(mm0->pgd_base, phy, 0);
@@ -316,13 +333,133 @@ void vm_unmmap(struct vm *vm)
 	flush_local_tlb_guest();
 }
 
+static void hvm_map_mem_block(struct vm *vm, int index,
+		struct mem_block *block)
+{
+	unsigned long phy, *vm0_pmd;
+	struct vm *vm0 = get_vm_by_id(0);
+
+	phy = vm->mm.hvm_mmap_base + ((unsigned long)index << MEM_BLOCK_SHIFT);
+	vm0_pmd = (unsigned long *)get_mapping_pmd(vm0->mm.pgd_base, phy, 0);
+	if (!vm0_pmd || mapping_error(vm0_pmd))
+		return;
+
+	*(vm0_pmd + pmd_idx(phy)) = (block->phy_base & PAGETABLE_ATTR_MASK) |
+		page_table_description(VM_DES_BLOCK | VM_NORMAL);
+	dsb();
+}
+
+/*
+ * allocate and map the index-th memory block of the
+ * guest vm, the block will also mapped to vm0 if vm0
+ * has already mapped this vm's memory
+ */
+static int vm_map_mem_block(struct vm *vm, int index)
+{
+	int ret;
+	unsigned long base;
+	struct mem_block *block;
+	struct mm_struct *mm = &vm->mm;
+	struct memory_region *region = &mm->memory_regions[0];
+
+	if ((index < 0) || (index >= mm->nr_mem_blocks))
+		return -EINVAL;
+
+	block = mm->mem_blocks[index];
+	if (block)
+		goto out;
+
+	block = alloc_mem_block(GFB_VM);
+	if (!block)
+		return -ENOMEM;
+
+	/*
+	 * other vcpus may fault on the same block at the
+	 * same time, only the first one can install its
+	 * block, the others will fault again until the
+	 * mapping is ready
+	 */
+	spin_lock(&mm->lock);
+	if (mm->mem_blocks[index]) {
+		spin_unlock(&mm->lock);
+		release_mem_block(block);
+		block = mm->mem_blocks[index];
+		goto out;
+	}
+
+	mm->mem_blocks[index] = block;
+	list_add_tail(&mm->block_list, &block->list);
+	region->free_size -= MEM_BLOCK_SIZE;
+	spin_unlock(&mm->lock);
+
+	/*
+	 * begin to map the memory for guest, actually
+	 * this is map the ipa to pa in stage 2
+	 */
+	base = region->vir_base + ((unsigned long)index << MEM_BLOCK_SHIFT);
+	ret = create_guest_mapping(vm, base, block->phy_base,
+			MEM_BLOCK_SIZE, VM_NORMAL);
+	if (ret)
+		return ret;
+out:
+	if (mm->hvm_mmaped)
+		hvm_map_mem_block(vm, index, block);
+
+	return 0;
+}
+
+/*
+ * called when a stage 2 translation fault happened, if the
+ * ipa belongs to a memory block of a guest vm which has
+ * not been allocated, allocate and map it then the guest
+ * can retry the access
+ */
+int vm_mem_fault(struct vm *vm, unsigned long ipa)
+{
+	struct vm *gvm;
+	struct mm_struct *mm;
+	struct memory_region *region;
+
+	if (!vm_is_hvm(vm)) {
+		if (!(vm->flags & VM_FLAGS_DEMAND_MEM))
+			return -EFAULT;
+
+		region = &vm->mm.memory_regions[0];
+		if ((ipa < region->vir_base) ||
+				(ipa >= region->vir_base + region->size))
+			return -EFAULT;
+
+		return vm_map_mem_block(vm,
+				(ipa - region->vir_base) >> MEM_BLOCK_SHIFT);
+	}
+
+	/* vm0 access the guest vm's memory by the hvm mmap space */
+	if ((ipa < HVM_NORMAL_MMAP_START) ||
+			(ipa >= HVM_NORMAL_MMAP_START + HVM_NORMAL_MMAP_SIZE))
+		return -EFAULT;
+
+	for_each_vm(gvm) {
+		mm = &gvm->mm;
+		if (vm_is_hvm(gvm) || !mm->hvm_mmaped ||
+				!(gvm->flags & VM_FLAGS_DEMAND_MEM))
+			continue;
+
+		region = &mm->memory_regions[0];
+		if ((ipa >= mm->hvm_mmap_base) &&
+				(ipa < mm->hvm_mmap_base + region->size))
+			return vm_map_mem_block(gvm,
+				(ipa - mm->hvm_mmap_base) >> MEM_BLOCK_SHIFT);
+	}
+
+	return -EFAULT;
+}
+
 /* alloc physical memory for guest vm */
-int alloc_vm_memory(struct vm *vm)
+int alloc_vm_memory(struct vm *vm, unsigned long prefault)
 {
-	int i, count;
+	int i, count, ret;
 	unsigned long base;
 	struct mm_struct *mm = &vm->mm;
-	struct mem_block *block;
 	struct memory_region *region = &mm->memory_regions[0];
 
 	base = ALIGN(region->vir_base, MEM_BLOCK_SIZE);
@@ -330,32 +467,34 @@ int alloc_vm_memory(struct vm *vm)
 		pr_warn("memory base is not mem_block align\n");
 
 	count = region->size >> MEM_BLOCK_SHIFT;
+	mm->mem_blocks = zalloc(count * sizeof(struct mem_block *));
+	if (!mm->mem_blocks)
+		return -ENOMEM;
+
+	mm->nr_mem_blocks = count;
 
 	/*
-	 * here get all the memory block for the vm
-	 * TBD: get contiueous memory or not contiueous ?
+	 * if the vm's memory is allocated on demand, only
+	 * the first prefault bytes (where the kernel image
+	 * is loaded) are allocated here, the others are
+	 * allocated when the vm touch them
 	 */
-	for (i = 0; i < count; i++) {
-		block = alloc_mem_block(GFB_VM);
-		if (!block)
-			goto free_vm_memory;
+	if (vm->flags & VM_FLAGS_DEMAND_MEM) {
+		prefault = BALIGN(prefault, MEM_BLOCK_SIZE) >> MEM_BLOCK_SHIFT;
+		if (prefault < count)
+			count = prefault;
 
-		// block->vmid = vm->vmid;
-		list_add_tail(&mm->block_list, &block->list);
-		region->free_size -= MEM_BLOCK_SIZE;
+		pr_info("vm-%d memory on demand, prefault %d blocks\n",
+				vm->vmid, count);
 	}
 
 	/*
-	 * begin to map the memory for guest, actually
-	 * this is map the ipa to pa in stage 2
+	 * TBD: get contiueous memory or not contiueous ?
 	 */
-	list_for_each_entry(block, &mm->block_list, list) {
-		i = create_guest_mapping(vm, base, block->phy_base,
-				MEM_BLOCK_SIZE, VM_NORMAL);
-		if (i)
+	for (i = 0; i < count; i++) {
+		ret = vm_map_mem_block(vm, i);
+		if (ret)
 			goto free_vm_memory;
-
-		base += MEM_BLOCK_SIZE;
 	}
 
 	return 0;
@@ -370,28 +509,113 @@ phy_addr_t get_vm_memblock_address(struct vm *vm, unsigned long a)
 {
 	struct mm_struct *mm = &vm->mm;
 	struct mem_block *block;
-	unsigned long base = 0;
 	struct memory_region *region = &mm->memory_regions[0];
 	unsigned long offset = a - region->vir_base;
+	int index;
 
 	if ((a < region->vir_base) || (a >= region->vir_base + region->size))
 		return 0;
 
-	list_for_each_entry(block, &mm->block_list, list) {
-		if (offset == base)
-			return block->phy_base;
-		base += MEM_BLOCK_SIZE;
+	if (!mm->mem_blocks || (offset & (MEM_BLOCK_SIZE - 1)))
+		return 0;
+
+	index = offset >> MEM_BLOCK_SHIFT;
+	if (!mm->mem_blocks[index] && (vm->flags & VM_FLAGS_DEMAND_MEM))
+		vm_map_mem_block(vm, index);
+
+	block = mm->mem_blocks[index];
+
+	return block ? block->phy_base : 0;
+}
+
+/*
+ * translate the ipa of the vm to the physical address, the
+ * memory of vm0 is described by its memory regions, and the
+ * memory of the guest vm is allocated as memory blocks
+ */
+static phy_addr_t vm_ipa_to_pa(struct vm *vm, unsigned long ipa)
+{
+	int i;
+	phy_addr_t pa;
+	struct memory_region *region;
+	struct mm_struct *mm = &vm->mm;
+
+	if (vm_is_hvm(vm)) {
+		for (i = 0; i < mm->nr_mem_regions; i++) {
+			region = &mm->memory_regions[i];
+			if ((ipa >= region->vir_base) &&
+				(ipa < region->vir_base + region->size))
+				return region->phy_base + (ipa - region->vir_base);
+		}
+
+		return 0;
+	}
+
+	pa = get_vm_memblock_address(vm, ipa & ~(MEM_BLOCK_SIZE - 1));
+	if (!pa)
+		return 0;
+
+	return pa + (ipa & (MEM_BLOCK_SIZE - 1));
+}
+
+/*
+ * copy data between the hypervisor and the normal memory
+ * of the vm, the memory is mapped to the hypervisor block
+ * by block when it is accessed, used by the virtual devices
+ * which keep their tables in the guest memory
+ */
+static int vm_ipa_copy(struct vm *vm, void *buf,
+		unsigned long ipa, size_t size, int to_vm)
+{
+	phy_addr_t pa;
+	size_t count;
+
+	while (size > 0) {
+		count = MEM_BLOCK_SIZE - (ipa & (MEM_BLOCK_SIZE - 1));
+		if (count > size)
+			count = size;
+
+		pa = vm_ipa_to_pa(vm, ipa);
+		if (!pa)
+			return -EFAULT;
+
+		if (create_host_mapping(pa, pa, count, 0))
+			return -ENOMEM;
+
+		if (to_vm)
+			memcpy((void *)pa, buf, count);
+		else
+			memcpy(buf, (void *)pa, count);
+
+		destroy_host_mapping(pa, count);
+
+		buf += count;
+		ipa += count;
+		size -= count;
 	}
 
 	return 0;
 }
 
+int copy_from_vm_ipa(struct vm *vm, void *dst, unsigned long ipa, size_t size)
+{
+	return vm_ipa_copy(vm, dst, ipa, size, 0);
+}
+
+int copy_to_vm_ipa(struct vm *vm, unsigned long ipa, void *src, size_t size)
+{
+	return vm_ipa_copy(vm, src, ipa, size, 1);
+}
+
 void vm_mm_struct_init(struct vm *vm)
 {
 	struct mm_struct *mm = &vm->mm;
 
 	init_list(&mm->block_list);
 	mm->head = NULL;
+	mm->mem_blocks = NULL;
+	mm->nr_mem_blocks = 0;
+	mm->hvm_mmaped = 0;
 	mm->pgd_base = 0;
 	mm->nr_mem_regions = 0;
 	spin_lock_init(&mm->lock);